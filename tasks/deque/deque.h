@@ -1,3 +1,1755 @@
-#define NO_TEST  // remove when solution is ready
+#pragma once
 
-// your code here
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Chunk-size policies for Deque. A policy exposes `chunk_size<T>`, the number
+// of elements per chunk; both policies below round it down to a power of two
+// so that locating an element compiles to a shift and a mask.
+
+// Chunks of about `Bytes` bytes, but never fewer than one element.
+template <size_t Bytes>
+struct ChunkBytes {
+  template <typename T>
+  static constexpr size_t chunk_size =
+      std::bit_floor(std::max<size_t>(Bytes / sizeof(T), 1));
+};
+
+// Page-sized chunks for small types, which keeps the map short for
+// Deque<char>, and at least `min_elements` per chunk for large types, so that
+// walking a deque of big structs does not hop between chunks every few
+// elements.
+struct DefaultChunkSize {
+  static constexpr size_t page_size = 4096;
+  static constexpr size_t min_elements = 16;
+
+  template <typename T>
+  static constexpr size_t chunk_size =
+      std::max(ChunkBytes<page_size>::template chunk_size<T>, min_elements);
+};
+
+// A fixed capacity of `N` elements. The deque allocates all its chunks up
+// front and cycles through them as a ring, so pushing and popping never
+// allocate; pushes past `N` throw std::length_error, and try_push_back and
+// try_push_front return false instead. Chunks are capped at N elements
+// rounded up to a power of two, so small rings stay small.
+template <size_t N, typename Base = DefaultChunkSize>
+struct Bounded {
+  static_assert(N > 0, "Bounded deques must hold at least one element");
+
+  static constexpr size_t capacity = N;
+
+  template <typename T>
+  static constexpr size_t chunk_size =
+      std::min(Base::template chunk_size<T>, std::bit_ceil(N));
+};
+
+// Copies share chunks instead of copying elements, and a chunk is cloned the
+// first time one of its sharers writes to it, so copying a deque costs
+// O(chunks). Once a deque has handed out a mutable reference or iterator,
+// later copies of it copy elements again, so that writes through that
+// reference can never show up in a copy.
+//
+// This changes one invalidation rule. References, pointers and iterators
+// taken through non-const access stay valid across copies and writes as in
+// a plain Deque, since taking one stops the deque from sharing. Those taken
+// only through const access, while the deque shares chunks with a copy, are
+// invalidated by the next non-const call on it, which may clone the chunk
+// they point into. Copying reads the source and nothing else, so a const
+// deque can be copied from several threads at once.
+template <typename Base = DefaultChunkSize>
+struct CopyOnWrite {
+  static constexpr bool copy_on_write = true;
+
+  template <typename T>
+  static constexpr size_t chunk_size = Base::template chunk_size<T>;
+};
+
+// Keeps its first chunks, of N elements rounded up to a power of two, and a
+// small map inside the Deque object. Two chunks are kept, since N elements
+// starting anywhere in a chunk may reach into the next one, so a deque that
+// never holds more than N elements never calls the allocator. Types whose
+// moves may throw keep everything on the heap, so that moving and swapping
+// deques stay noexcept.
+template <size_t N, typename Base = DefaultChunkSize>
+struct InlineFirstChunk {
+  static_assert(N > 0, "An inline chunk must hold at least one element");
+
+  static constexpr size_t inline_capacity = N;
+
+  template <typename T>
+  static constexpr size_t chunk_size =
+      std::min(Base::template chunk_size<T>, std::bit_ceil(N));
+};
+
+// Building with DEQUE_COPY_ON_WRITE makes copy-on-write the default.
+#ifdef DEQUE_COPY_ON_WRITE
+using DefaultDequePolicy = CopyOnWrite<>;
+#else
+using DefaultDequePolicy = DefaultChunkSize;
+#endif
+
+// Types whose objects can be moved to another address with memcpy, leaving
+// nothing to destroy at the old one. Deque shifts such elements with memmove;
+// specialize to true for types that own their resources but never point into
+// themselves.
+template <typename T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+// Double-ended queue stored as a map of fixed-size chunks. Elements never
+// move on push/pop at either end, so pointers and references to them stay
+// valid; iterators hold a position in the map and are invalidated whenever
+// the map itself is reallocated, or, in a bounded deque, rotated.
+template <typename T, typename Alloc = std::allocator<T>,
+          typename ChunkPolicy = DefaultDequePolicy>
+class Deque {
+ private:
+  template <bool IsConst>
+  class BaseIterator;
+
+  template <bool IsConst>
+  class SegmentRange;
+
+  static constexpr bool is_bounded = requires { ChunkPolicy::capacity; };
+  static constexpr bool is_cow = requires { ChunkPolicy::copy_on_write; };
+  static constexpr bool has_inline =
+      requires { ChunkPolicy::inline_capacity; } &&
+      std::is_nothrow_move_constructible_v<T>;
+
+ public:
+  using value_type = T;
+  using allocator_type = Alloc;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = BaseIterator<false>;
+  using const_iterator = BaseIterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  Deque()
+      : Deque(Alloc()) {
+  }
+
+  explicit Deque(const Alloc& alloc)
+      : alloc_(alloc) {
+    if constexpr (is_bounded) {
+      allocate_ring();
+    }
+  }
+
+  explicit Deque(size_t count, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    fill_back(count);
+  }
+
+  Deque(size_t count, const T& value, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    fill_back(count, value);
+  }
+
+  Deque(const Deque& other)
+      : Deque(other, AllocTraits::select_on_container_copy_construction(
+                         other.alloc_)) {
+  }
+
+  Deque(const Deque& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    if constexpr (is_cow) {
+      if (!other.cow_.leaked && alloc_ == other.alloc_) {
+        share(other);
+        return;
+      }
+    }
+    try {
+      reserve_back(other.size_);
+      for (const T& value : other) {
+        construct_back(value);
+      }
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  Deque(Deque&& other) noexcept
+      : alloc_(std::move(other.alloc_)) {
+    steal(other);
+  }
+
+  // Steals the storage of `other` if `alloc` compares equal to its
+  // allocator, and otherwise moves its elements one by one.
+  Deque(Deque&& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    if (alloc_ == other.alloc_) {
+      steal(other);
+      return;
+    }
+    try {
+      reserve_back(other.size_);
+      for (T& value : other) {
+        construct_back(std::move(value));
+      }
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  ~Deque() {
+    release();
+  }
+
+  Deque& operator=(const Deque& other) {
+    if (this != &other) {
+      Deque copy(other,
+                 AllocTraits::propagate_on_container_copy_assignment::value
+                     ? other.alloc_
+                     : alloc_);
+      swap_all(copy);
+    }
+    return *this;
+  }
+
+  Deque& operator=(Deque&& other) noexcept(move_steals_storage) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (move_steals_storage) {
+      Deque moved(std::move(other));
+      swap_all(moved);
+    } else {
+      Deque moved(std::move(other), alloc_);
+      swap_all(moved);
+    }
+    return *this;
+  }
+
+  // Allocators are swapped only if they propagate on swap; if they do not,
+  // they must compare equal. Deques with inline storage swap by moving the
+  // inline parts over, which invalidates iterators as a move does.
+  void swap(Deque& other) noexcept {
+    swap_with<AllocTraits::propagate_on_container_swap::value>(other);
+  }
+
+  allocator_type get_allocator() const {
+    return alloc_;
+  }
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  static constexpr size_t capacity() noexcept
+    requires is_bounded
+  {
+    return ChunkPolicy::capacity;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  T& operator[](size_t index) noexcept(!is_cow) {
+    prepare_write(start_ + index);
+    return *slot(start_ + index);
+  }
+
+  const T& operator[](size_t index) const noexcept {
+    return *slot(start_ + index);
+  }
+
+  T& at(size_t index) {
+    check_index(index);
+    return (*this)[index];
+  }
+
+  const T& at(size_t index) const {
+    check_index(index);
+    return (*this)[index];
+  }
+
+  T& front() noexcept(!is_cow) {
+    return (*this)[0];
+  }
+
+  const T& front() const noexcept {
+    return (*this)[0];
+  }
+
+  T& back() noexcept(!is_cow) {
+    return (*this)[size_ - 1];
+  }
+
+  const T& back() const noexcept {
+    return (*this)[size_ - 1];
+  }
+
+  iterator begin() noexcept(!is_cow) {
+    detach();
+    return make_iterator<false>(start_);
+  }
+
+  const_iterator begin() const noexcept {
+    return make_iterator<true>(start_);
+  }
+
+  const_iterator cbegin() const noexcept {
+    return begin();
+  }
+
+  iterator end() noexcept(!is_cow) {
+    detach();
+    return make_iterator<false>(start_ + size_);
+  }
+
+  const_iterator end() const noexcept {
+    return make_iterator<true>(start_ + size_);
+  }
+
+  const_iterator cend() const noexcept {
+    return end();
+  }
+
+  reverse_iterator rbegin() noexcept(!is_cow) {
+    return reverse_iterator(end());
+  }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator crbegin() const noexcept {
+    return rbegin();
+  }
+
+  reverse_iterator rend() noexcept(!is_cow) {
+    return reverse_iterator(begin());
+  }
+
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  const_reverse_iterator crend() const noexcept {
+    return rend();
+  }
+
+  void push_back(const T& value) {
+    construct_back(value);
+  }
+
+  void push_back(T&& value) {
+    construct_back(std::move(value));
+  }
+
+  void push_front(const T& value) {
+    construct_front(value);
+  }
+
+  void push_front(T&& value) {
+    construct_front(std::move(value));
+  }
+
+  // Bounded deques only: push unless the deque is full.
+  bool try_push_back(const T& value)
+    requires is_bounded
+  {
+    return try_construct_back(value);
+  }
+
+  bool try_push_back(T&& value)
+    requires is_bounded
+  {
+    return try_construct_back(std::move(value));
+  }
+
+  bool try_push_front(const T& value)
+    requires is_bounded
+  {
+    return try_construct_front(value);
+  }
+
+  bool try_push_front(T&& value)
+    requires is_bounded
+  {
+    return try_construct_front(std::move(value));
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    construct_back(std::forward<Args>(args)...);
+    return back();
+  }
+
+  template <typename... Args>
+  T& emplace_front(Args&&... args) {
+    construct_front(std::forward<Args>(args)...);
+    return front();
+  }
+
+  void pop_back() noexcept(!is_cow) {
+    if constexpr (is_cow) {
+      unshare_node(node_of(start_ + size_ - 1));
+    }
+    --size_;
+    size_t pos = start_ + size_;
+    AllocTraits::destroy(alloc_, slot(pos));
+    if (slot_of(pos) == 0) {
+      release_node(node_of(pos));
+    }
+  }
+
+  void pop_front() noexcept(!is_cow) {
+    if constexpr (is_cow) {
+      unshare_node(first_node());
+    }
+    AllocTraits::destroy(alloc_, slot(start_));
+    ++start_;
+    --size_;
+    if (slot_of(start_) == 0) {
+      release_node(node_of(start_) - 1);
+    }
+  }
+
+  // A copy-on-write deque lets go of its chunks instead, since popping from
+  // a shared one would clone it first.
+  void clear() noexcept {
+    if constexpr (is_cow) {
+      release();
+      return;
+    }
+    while (size_ != 0) {
+      pop_back();
+    }
+  }
+
+  // Hands cached chunks, and chunks reserved past either end, back to the
+  // allocator; an empty deque also gives up its map. A bounded deque keeps
+  // its ring.
+  void shrink_to_fit() noexcept {
+    if constexpr (is_bounded) {
+      return;
+    }
+    while (spare_count_ != 0) {
+      deallocate_chunk(spare_chunks_[--spare_count_]);
+    }
+    size_t first = first_node();
+    size_t last = end_node();
+    for (size_t node = 0; node < map_size_; ++node) {
+      bool used = node >= first && node < last;
+      if (!used && map_[node] != nullptr) {
+        deallocate_chunk(map_[node]);
+        map_[node] = nullptr;
+      }
+    }
+    if (size_ == 0) {
+      deallocate_map(map_, map_size_);
+      map_ = nullptr;
+      map_size_ = 0;
+      start_ = 0;
+    }
+  }
+
+  // Inserts at either end have the strong guarantee. Inserts in the middle
+  // shift whichever side of `pos` is shorter, moving each element once per
+  // call, and keep the strong guarantee too: relocatable elements are
+  // memmoved aside and back on failure, elements with noexcept moves are
+  // rotated into place after the new ones are built, and anything else is
+  // copied into a rebuilt deque.
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    size_t index = pos - cbegin();
+    if (index == 0) {
+      construct_front(std::forward<Args>(args)...);
+    } else if (index == size_) {
+      construct_back(std::forward<Args>(args)...);
+    } else if constexpr (opens_gap_first) {
+      // The gap is opened before the element is built, so the arguments
+      // must not refer into the deque by then.
+      T value(std::forward<Args>(args)...);
+      insert_n(index, 1, [&](T* place) {
+        AllocTraits::construct(alloc_, place, std::move(value));
+      });
+    } else {
+      insert_n(index, 1, [&](T* place) {
+        AllocTraits::construct(alloc_, place, std::forward<Args>(args)...);
+      });
+    }
+    return begin() + index;
+  }
+
+  iterator insert(const_iterator pos, const T& value) {
+    return emplace(pos, value);
+  }
+
+  iterator insert(const_iterator pos, T&& value) {
+    return emplace(pos, std::move(value));
+  }
+
+  iterator insert(const_iterator pos, size_t count, const T& value) {
+    size_t index = pos - cbegin();
+    if constexpr (opens_gap_first) {
+      T copy(value);
+      insert_n(index, count, [&](T* place) {
+        AllocTraits::construct(alloc_, place, std::as_const(copy));
+      });
+    } else {
+      insert_n(index, count, [&](T* place) {
+        AllocTraits::construct(alloc_, place, value);
+      });
+    }
+    return begin() + index;
+  }
+
+  template <std::input_iterator InputIt>
+  iterator insert(const_iterator pos, InputIt first, InputIt last) {
+    size_t index = pos - cbegin();
+    if constexpr (std::forward_iterator<InputIt>) {
+      insert_n(index, std::distance(first, last), [&](T* place) {
+        AllocTraits::construct(alloc_, place, *first);
+        ++first;
+      });
+    } else {
+      // A single-pass range has to be read before the gap can be sized.
+      Deque buffer(alloc_);
+      for (; first != last; ++first) {
+        buffer.construct_back(*first);
+      }
+      auto source = buffer.begin();
+      insert_n(index, buffer.size_, [&](T* place) {
+        AllocTraits::construct(alloc_, place, std::move(*source));
+        ++source;
+      });
+    }
+    return begin() + index;
+  }
+
+  iterator erase(const_iterator pos) {
+    return erase(pos, std::next(pos));
+  }
+
+  // Closes the gap by moving whichever side of [first, last) is shorter.
+  iterator erase(const_iterator first, const_iterator last) {
+    size_t index = first - cbegin();
+    size_t count = last - first;
+    if (count == 0) {
+      return begin() + index;
+    }
+    detach();
+    if constexpr (opens_gap_first) {
+      destroy_range(start_ + index, start_ + index + count);
+      if (index < size_ - index - count) {
+        relocate(start_, start_ + count, index);
+        drop_front(count);
+      } else {
+        relocate(start_ + index + count, start_ + index,
+                 size_ - index - count);
+        drop_back(count);
+      }
+    } else if (index < size_ - index - count) {
+      std::move_backward(begin(), begin() + index, begin() + index + count);
+      for (size_t i = 0; i < count; ++i) {
+        pop_front();
+      }
+    } else {
+      std::move(begin() + index + count, end(), begin() + index);
+      for (size_t i = 0; i < count; ++i) {
+        pop_back();
+      }
+    }
+    return begin() + index;
+  }
+
+  // The deque as its contiguous pieces, front to back, each a std::span.
+  // Looping over a span needs no chunk-boundary check per element, so such
+  // loops vectorize where iterator loops do not.
+  SegmentRange<false> segments() noexcept(!is_cow) {
+    return SegmentRange<false>(begin(), end());
+  }
+
+  SegmentRange<true> segments() const noexcept {
+    return SegmentRange<true>(begin(), end());
+  }
+
+  template <typename F>
+  void for_each_segment(F f) {
+    iterator::visit_pieces(begin(), end(), [&](T* first, T* last) {
+      f(std::span<T>(first, last));
+      return true;
+    });
+  }
+
+  template <typename F>
+  void for_each_segment(F f) const {
+    const_iterator::visit_pieces(begin(), end(),
+                                 [&](const T* first, const T* last) {
+      f(std::span<const T>(first, last));
+      return true;
+    });
+  }
+
+ private:
+  using AllocTraits = std::allocator_traits<Alloc>;
+  using MapAlloc = typename AllocTraits::template rebind_alloc<T*>;
+  using MapAllocTraits = std::allocator_traits<MapAlloc>;
+
+  static constexpr size_t chunk_size = ChunkPolicy::template chunk_size<T>;
+  static_assert(chunk_size > 0, "Deque chunks must hold elements");
+
+  static constexpr size_t min_map_size = 8;
+  static constexpr size_t spare_chunk_limit = 4;
+
+  // A bounded deque's map is a ring of chunks, each slot always holding one,
+  // with enough of them for a full deque starting anywhere in a chunk.
+  static constexpr size_t ring_size = [] {
+    if constexpr (is_bounded) {
+      return (ChunkPolicy::capacity + 2 * chunk_size - 2) / chunk_size;
+    } else {
+      return size_t{0};
+    }
+  }();
+
+  // Copy-on-write chunks carry a count of the deques sharing them.
+  struct CowChunk {
+    std::atomic<size_t> refs = 1;
+    alignas(T) unsigned char storage[chunk_size * sizeof(T)];
+  };
+
+  // Whether a chunk is shared is known only from its count: a copy does not
+  // tell its source that it now shares the source's chunks.
+  struct CowFlags {
+    // A mutable reference or iterator has been handed out, so copies copy
+    // elements instead of sharing chunks.
+    bool leaked = false;
+    // Leaked, and every live chunk has been unshared since, so none of them
+    // is or will be shared.
+    bool detached = false;
+  };
+
+  struct NoCowFlags {};
+
+  using CowAlloc = typename AllocTraits::template rebind_alloc<CowChunk>;
+  using CowAllocTraits = std::allocator_traits<CowAlloc>;
+
+  static CowChunk* header(T* chunk) noexcept {
+    return reinterpret_cast<CowChunk*>(reinterpret_cast<unsigned char*>(chunk) -
+                                       offsetof(CowChunk, storage));
+  }
+
+  // Inline storage: two chunks, and a map of a few nodes plus the null slot
+  // every map ends with.
+  static constexpr size_t inline_chunks = 2;
+  static constexpr size_t inline_map_size = 4;
+
+  struct InlineStorage {
+    T* map[inline_map_size + 1] = {};
+    alignas(T) unsigned char chunks[inline_chunks][chunk_size * sizeof(T)];
+    bool in_use[inline_chunks] = {};
+  };
+
+  struct NoInlineStorage {};
+
+  static constexpr bool move_steals_storage =
+      AllocTraits::propagate_on_container_move_assignment::value ||
+      AllocTraits::is_always_equal::value;
+
+  // How middle inserts and erases shift elements: relocatable ones are
+  // memmoved to open or close the gap, ones with noexcept moves are rotated,
+  // and the rest are copied into a rebuilt deque so that an exception
+  // halfway cannot leave the deque mangled.
+  static constexpr bool opens_gap_first = IsTriviallyRelocatable<T>::value;
+  static constexpr bool rotates_in_place =
+      std::is_nothrow_move_constructible_v<T> &&
+      std::is_nothrow_move_assignable_v<T>;
+
+  // A map layout prepared before any element is touched, so that a throwing
+  // constructor can still leave the old map in place.
+  struct MapPlan {
+    T** map;
+    size_t size;
+  };
+
+  static size_t node_of(size_t pos) noexcept {
+    return pos / chunk_size;
+  }
+
+  static size_t slot_of(size_t pos) noexcept {
+    return pos % chunk_size;
+  }
+
+  T* slot(size_t pos) const noexcept {
+    return map_[node_of(pos)] + slot_of(pos);
+  }
+
+  size_t first_node() const noexcept {
+    return node_of(start_);
+  }
+
+  size_t end_node() const noexcept {
+    return size_ == 0 ? first_node() : node_of(start_ + size_ - 1) + 1;
+  }
+
+  // Without a map the deque is empty; its iterators point into a shared
+  // all-null one, so that stepping them never reads outside a map.
+  static T** empty_map() noexcept {
+    static T* map[3] = {};
+    return map + 1;
+  }
+
+  // The stand-in chunk for iterators at a node without one. Stepping such an
+  // iterator is a caller error, but it stays off the null pointer.
+  static T* no_chunk() noexcept {
+    alignas(T) static unsigned char storage[sizeof(T)];
+    return reinterpret_cast<T*>(storage);
+  }
+
+  // The slots of a live node that hold elements.
+  std::pair<size_t, size_t> live_slots(size_t node) const noexcept {
+    size_t first = node == first_node() ? slot_of(start_) : 0;
+    size_t last =
+        node + 1 == end_node() ? slot_of(start_ + size_ - 1) + 1 : chunk_size;
+    return {first, last};
+  }
+
+  template <bool IsConst>
+  BaseIterator<IsConst> make_iterator(size_t pos) const noexcept {
+    if (map_ == nullptr) {
+      return BaseIterator<IsConst>(empty_map(), 0);
+    }
+    return BaseIterator<IsConst>(map_ + node_of(pos),
+                                 static_cast<difference_type>(slot_of(pos)));
+  }
+
+  void check_index(size_t index) const {
+    if (index >= size_) {
+      throw std::out_of_range("Deque::at: index out of range");
+    }
+  }
+
+  // Queue-like use empties a chunk at one end just before it needs a fresh
+  // one at the other, so the last few freed chunks are kept for reuse
+  // instead of going back to the allocator.
+  T* allocate_chunk() {
+    if constexpr (has_inline) {
+      for (size_t i = 0; i < inline_chunks; ++i) {
+        if (!inline_.in_use[i]) {
+          inline_.in_use[i] = true;
+          return inline_chunk(i);
+        }
+      }
+    }
+    if (spare_count_ != 0) {
+      return spare_chunks_[--spare_count_];
+    }
+    if constexpr (is_cow) {
+      CowAlloc cow_alloc(alloc_);
+      CowChunk* block = CowAllocTraits::allocate(cow_alloc, 1);
+      ::new (static_cast<void*>(block)) CowChunk();
+      return reinterpret_cast<T*>(block->storage);
+    }
+    return AllocTraits::allocate(alloc_, chunk_size);
+  }
+
+  void recycle_chunk(T* chunk) noexcept {
+    if constexpr (has_inline) {
+      size_t index = inline_index(chunk);
+      if (index != inline_chunks) {
+        inline_.in_use[index] = false;
+        return;
+      }
+    }
+    if (spare_count_ < spare_chunk_limit) {
+      spare_chunks_[spare_count_++] = chunk;
+    } else {
+      deallocate_chunk(chunk);
+    }
+  }
+
+  void deallocate_chunk(T* chunk) noexcept {
+    if constexpr (has_inline) {
+      size_t index = inline_index(chunk);
+      if (index != inline_chunks) {
+        inline_.in_use[index] = false;
+        return;
+      }
+    }
+    if constexpr (is_cow) {
+      CowAlloc cow_alloc(alloc_);
+      CowAllocTraits::deallocate(cow_alloc, header(chunk), 1);
+    } else {
+      AllocTraits::deallocate(alloc_, chunk, chunk_size);
+    }
+  }
+
+  T* inline_chunk(size_t index) noexcept {
+    return reinterpret_cast<T*>(inline_.chunks[index]);
+  }
+
+  // Which inline chunk `chunk` is, or inline_chunks for a heap one.
+  size_t inline_index(const T* chunk) const noexcept {
+    size_t index = 0;
+    while (index < inline_chunks &&
+           chunk != reinterpret_cast<const T*>(inline_.chunks[index])) {
+      ++index;
+    }
+    return index;
+  }
+
+  bool is_inline_map(T* const* map) const noexcept {
+    if constexpr (has_inline) {
+      return map == inline_.map;
+    } else {
+      return false;
+    }
+  }
+
+  // Swaps allocators too, for the assignments: the deque they build already
+  // has the allocator this one is to end up with.
+  void swap_all(Deque& other) noexcept {
+    swap_with<true>(other);
+  }
+
+  template <bool SwapsAllocators>
+  void swap_with(Deque& other) noexcept {
+    if constexpr (has_inline) {
+      Deque tmp(std::move(other));
+      if constexpr (SwapsAllocators) {
+        other.alloc_ = std::move(alloc_);
+        alloc_ = std::move(tmp.alloc_);
+      }
+      other.steal(*this);
+      steal(tmp);
+      return;
+    }
+    if constexpr (SwapsAllocators) {
+      std::swap(alloc_, other.alloc_);
+    }
+    std::swap(map_, other.map_);
+    std::swap(map_size_, other.map_size_);
+    std::swap(start_, other.start_);
+    std::swap(size_, other.size_);
+    std::swap(spare_chunks_, other.spare_chunks_);
+    std::swap(spare_count_, other.spare_count_);
+    std::swap(cow_, other.cow_);
+  }
+
+  // Takes over everything `other` holds, leaving it empty; this deque must
+  // hold nothing yet. Pointers are taken as they are, except into `other`'s
+  // inline storage: its map is copied over, and elements in its inline
+  // chunks are moved into this deque's ones.
+  void steal(Deque& other) noexcept {
+    map_ = std::exchange(other.map_, nullptr);
+    map_size_ = std::exchange(other.map_size_, 0);
+    start_ = std::exchange(other.start_, 0);
+    size_ = std::exchange(other.size_, 0);
+    spare_count_ = std::exchange(other.spare_count_, 0);
+    std::copy(other.spare_chunks_, other.spare_chunks_ + spare_count_,
+              spare_chunks_);
+    cow_ = std::exchange(other.cow_, {});
+    if constexpr (has_inline) {
+      if (other.is_inline_map(map_)) {
+        std::copy(other.inline_.map, other.inline_.map + map_size_ + 1,
+                  inline_.map);
+        map_ = inline_.map;
+      }
+      for (size_t index = 0; index < inline_chunks; ++index) {
+        if (!std::exchange(other.inline_.in_use[index], false)) {
+          continue;
+        }
+        T* theirs = other.inline_chunk(index);
+        T* ours = inline_chunk(index);
+        size_t node = std::find(map_, map_ + map_size_, theirs) - map_;
+        if (node >= first_node() && node < end_node()) {
+          auto [first, last] = live_slots(node);
+          for (size_t i = first; i < last; ++i) {
+            AllocTraits::construct(alloc_, ours + i, std::move(theirs[i]));
+            AllocTraits::destroy(alloc_, theirs + i);
+          }
+        }
+        map_[node] = ours;
+        inline_.in_use[index] = true;
+      }
+    }
+  }
+
+  // Copy-on-write: `other` is not leaked and uses an equal allocator, so its
+  // live chunks can be shared rather than copied.
+  void share(const Deque& other) {
+    if (other.map_ == nullptr) {
+      return;
+    }
+    map_ = allocate_map(other.map_size_);
+    map_size_ = other.map_size_;
+    start_ = other.start_;
+    size_ = other.size_;
+    for (size_t node = first_node(); node < end_node(); ++node) {
+      map_[node] = other.map_[node];
+      header(map_[node])->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Gives the deque its own copy of the live chunk at `node` if another deque
+  // shares it. Sharers never change a shared chunk, so they all hold the
+  // same elements in it.
+  void unshare_node(size_t node) {
+    T* chunk = map_[node];
+    if (cow_.detached ||
+        header(chunk)->refs.load(std::memory_order_acquire) == 1) {
+      return;
+    }
+    auto [first, last] = live_slots(node);
+    T* copy = allocate_chunk();
+    size_t built = first;
+    try {
+      for (; built < last; ++built) {
+        AllocTraits::construct(alloc_, copy + built,
+                               std::as_const(chunk[built]));
+      }
+    } catch (...) {
+      for (size_t i = first; i < built; ++i) {
+        AllocTraits::destroy(alloc_, copy + i);
+      }
+      recycle_chunk(copy);
+      throw;
+    }
+    unref_chunk(chunk, first, last);
+    map_[node] = copy;
+  }
+
+  // Copy-on-write: a mutable reference or iterator is about to be handed
+  // out, so every chunk it may reach has to be this deque's own.
+  void detach() {
+    if constexpr (is_cow) {
+      if (!cow_.detached) {
+        cow_.leaked = true;
+        for (size_t node = first_node(); node < end_node(); ++node) {
+          unshare_node(node);
+        }
+        cow_.detached = true;
+      }
+    }
+  }
+
+  void prepare_write(size_t pos) {
+    if constexpr (is_cow) {
+      cow_.leaked = true;
+      unshare_node(node_of(pos));
+    }
+  }
+
+  // Drops one reference to a shared chunk holding elements in [first, last),
+  // destroying them if it was the last one.
+  void unref_chunk(T* chunk, size_t first, size_t last) noexcept {
+    if (header(chunk)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      for (size_t i = first; i < last; ++i) {
+        AllocTraits::destroy(alloc_, chunk + i);
+      }
+      deallocate_chunk(chunk);
+    }
+  }
+
+  // Maps carry one null slot past their end, so that an iterator can look
+  // up the chunk of the end position even when it is past the last node.
+  T** allocate_map(size_t size) {
+    MapAlloc map_alloc(alloc_);
+    T** map = MapAllocTraits::allocate(map_alloc, size + 1);
+    std::fill(map, map + size + 1, nullptr);
+    return map;
+  }
+
+  void deallocate_map(T** map, size_t size) noexcept {
+    if (map != nullptr && !is_inline_map(map)) {
+      MapAlloc map_alloc(alloc_);
+      MapAllocTraits::deallocate(map_alloc, map, size + 1);
+    }
+  }
+
+  void release_node(size_t node) noexcept {
+    if constexpr (!is_bounded) {
+      recycle_chunk(map_[node]);
+      map_[node] = nullptr;
+    }
+  }
+
+  void allocate_ring() {
+    T** map = allocate_map(ring_size);
+    size_t node = 0;
+    try {
+      for (; node < ring_size; ++node) {
+        map[node] = AllocTraits::allocate(alloc_, chunk_size);
+      }
+    } catch (...) {
+      while (node != 0) {
+        deallocate_chunk(map[--node]);
+      }
+      deallocate_map(map, ring_size);
+      throw;
+    }
+    map_ = map;
+    map_size_ = ring_size;
+  }
+
+  void check_capacity(size_t count) const {
+    if (count > ChunkPolicy::capacity - size_) {
+      throw std::length_error("Deque: bounded capacity exceeded");
+    }
+  }
+
+  // Bounded deques: rotates the ring so that the chunks behind the first
+  // element come after the last one, making room for `count` more at the
+  // back. A moved-from deque gets a new ring here.
+  void rotate_for_back(size_t count) {
+    check_capacity(count);
+    if (map_ == nullptr) {
+      allocate_ring();
+    }
+    if (node_of(start_ + size_ + count - 1) >= map_size_) {
+      size_t first = first_node();
+      std::rotate(map_, map_ + first, map_ + map_size_);
+      start_ -= first * chunk_size;
+    }
+  }
+
+  void rotate_for_front(size_t count) {
+    check_capacity(count);
+    if (map_ == nullptr) {
+      allocate_ring();
+    }
+    if (start_ >= count) {
+      return;
+    }
+    if (size_ == 0) {
+      start_ = map_size_ * chunk_size;
+    } else {
+      size_t last = end_node();
+      std::rotate(map_, map_ + last, map_ + map_size_);
+      start_ += (map_size_ - last) * chunk_size;
+    }
+  }
+
+  // Plans a map with room for `before` nodes in front of the first used node
+  // and `from_first` nodes starting at it. Recentres in place when the
+  // current map is at most half full.
+  MapPlan plan_map(size_t before, size_t from_first) {
+    size_t total = before + from_first;
+    if (map_ != nullptr && 2 * total <= map_size_) {
+      return {map_, map_size_};
+    }
+    if constexpr (has_inline) {
+      if (map_ == nullptr && 2 * total <= inline_map_size) {
+        std::fill(inline_.map, inline_.map + inline_map_size + 1, nullptr);
+        return {inline_.map, inline_map_size};
+      }
+    }
+    size_t size = std::max({2 * map_size_, 2 * total, min_map_size});
+    return {allocate_map(size), size};
+  }
+
+  // Switches to the planned map, keeping `from_first` nodes starting at the
+  // first used one and releasing chunks outside them, which hold no elements.
+  void apply_map(MapPlan plan, size_t before, size_t from_first) noexcept {
+    size_t first = first_node();
+    size_t kept_end = std::min(first + from_first, map_size_);
+    size_t kept = kept_end > first ? kept_end - first : 0;
+    size_t new_first = before + (plan.size - before - from_first) / 2;
+    for (size_t node = 0; node < map_size_; ++node) {
+      if ((node < first || node >= kept_end) && map_[node] != nullptr) {
+        release_node(node);
+      }
+    }
+    if (plan.map == map_) {
+      if (new_first < first) {
+        std::copy(map_ + first, map_ + kept_end, map_ + new_first);
+      } else {
+        std::copy_backward(map_ + first, map_ + kept_end,
+                           map_ + new_first + kept);
+      }
+      std::fill(map_, map_ + new_first, nullptr);
+      std::fill(map_ + new_first + kept, map_ + map_size_, nullptr);
+    } else {
+      if (kept != 0) {
+        std::copy(map_ + first, map_ + kept_end, plan.map + new_first);
+      }
+      deallocate_map(map_, map_size_);
+    }
+    map_ = plan.map;
+    map_size_ = plan.size;
+    start_ = new_first * chunk_size + slot_of(start_);
+  }
+
+  void allocate_nodes(size_t first, size_t last) {
+    for (size_t node = first; node < last; ++node) {
+      if (map_[node] == nullptr) {
+        map_[node] = allocate_chunk();
+      }
+    }
+  }
+
+  // Makes sure chunks exist for `count` positions past the last element.
+  void reserve_back(size_t count) {
+    if (count == 0) {
+      return;
+    }
+    if constexpr (is_bounded) {
+      rotate_for_back(count);
+      return;
+    }
+    size_t last = node_of(start_ + size_ + count - 1);
+    if (last >= map_size_) {
+      size_t from_first = last - first_node() + 1;
+      apply_map(plan_map(0, from_first), 0, from_first);
+      last = node_of(start_ + size_ + count - 1);
+    }
+    allocate_nodes(node_of(start_ + size_), last + 1);
+  }
+
+  // Makes sure chunks exist for `count` positions before the first element.
+  void reserve_front(size_t count) {
+    if (count == 0) {
+      return;
+    }
+    if constexpr (is_bounded) {
+      rotate_for_front(count);
+      return;
+    }
+    if (start_ < count) {
+      size_t before =
+          (count - slot_of(start_) + chunk_size - 1) / chunk_size;
+      size_t from_first = std::max<size_t>(end_node() - first_node(), 1);
+      apply_map(plan_map(before, from_first), before, from_first);
+    }
+    allocate_nodes(node_of(start_ - count), node_of(start_ - 1) + 1);
+  }
+
+  // The common case of room in the edge chunk is kept apart from the
+  // out-of-line *_in_new_chunk paths so that it inlines into callers.
+  template <typename... Args>
+  void construct_back(Args&&... args) {
+    size_t pos = start_ + size_;
+    if (node_of(pos) < map_size_ && map_[node_of(pos)] != nullptr &&
+        !full()) {
+      if constexpr (is_cow) {
+        unshare_node(node_of(pos));
+      }
+      AllocTraits::construct(alloc_, slot(pos), std::forward<Args>(args)...);
+      ++size_;
+      return;
+    }
+    construct_back_in_new_chunk(std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  void construct_front(Args&&... args) {
+    if (start_ != 0 && map_[node_of(start_ - 1)] != nullptr && !full()) {
+      if constexpr (is_cow) {
+        unshare_node(node_of(start_ - 1));
+      }
+      AllocTraits::construct(alloc_, slot(start_ - 1),
+                             std::forward<Args>(args)...);
+      --start_;
+      ++size_;
+      return;
+    }
+    construct_front_in_new_chunk(std::forward<Args>(args)...);
+  }
+
+  // Builds the element before touching the map, so a throwing constructor
+  // leaves both the contents and all iterators intact.
+  template <typename... Args>
+  [[gnu::noinline]] void construct_back_in_new_chunk(Args&&... args) {
+    if constexpr (is_bounded) {
+      rotate_for_back(1);
+      AllocTraits::construct(alloc_, slot(start_ + size_),
+                             std::forward<Args>(args)...);
+      ++size_;
+      return;
+    }
+    size_t pos = start_ + size_;
+    size_t node = node_of(pos);
+    bool grow = node >= map_size_;
+    size_t from_first = node - first_node() + 1;
+    MapPlan plan = grow ? plan_map(0, from_first) : MapPlan{map_, map_size_};
+    T* chunk = build_in_new_chunk(plan, slot_of(pos),
+                                  std::forward<Args>(args)...);
+    if (grow) {
+      apply_map(plan, 0, from_first);
+    }
+    map_[node_of(start_ + size_)] = chunk;
+    ++size_;
+  }
+
+  template <typename... Args>
+  [[gnu::noinline]] void construct_front_in_new_chunk(Args&&... args) {
+    if constexpr (is_bounded) {
+      rotate_for_front(1);
+      AllocTraits::construct(alloc_, slot(start_ - 1),
+                             std::forward<Args>(args)...);
+      --start_;
+      ++size_;
+      return;
+    }
+    bool grow = start_ == 0;
+    size_t from_first = std::max<size_t>(end_node() - first_node(), 1);
+    MapPlan plan = grow ? plan_map(1, from_first) : MapPlan{map_, map_size_};
+    T* chunk = build_in_new_chunk(plan, slot_of(start_ + chunk_size - 1),
+                                  std::forward<Args>(args)...);
+    if (grow) {
+      apply_map(plan, 1, from_first);
+    }
+    map_[node_of(start_ - 1)] = chunk;
+    --start_;
+    ++size_;
+  }
+
+  bool full() const noexcept {
+    if constexpr (is_bounded) {
+      return size_ == ChunkPolicy::capacity;
+    } else {
+      return false;
+    }
+  }
+
+  template <typename... Args>
+  bool try_construct_back(Args&&... args) {
+    if (full()) {
+      return false;
+    }
+    construct_back(std::forward<Args>(args)...);
+    return true;
+  }
+
+  template <typename... Args>
+  bool try_construct_front(Args&&... args) {
+    if (full()) {
+      return false;
+    }
+    construct_front(std::forward<Args>(args)...);
+    return true;
+  }
+
+  template <typename... Args>
+  T* build_in_new_chunk(MapPlan plan, size_t offset, Args&&... args) {
+    T* chunk = nullptr;
+    try {
+      chunk = allocate_chunk();
+      AllocTraits::construct(alloc_, chunk + offset,
+                             std::forward<Args>(args)...);
+    } catch (...) {
+      if (chunk != nullptr) {
+        recycle_chunk(chunk);
+      }
+      if (plan.map != map_) {
+        deallocate_map(plan.map, plan.size);
+      }
+      throw;
+    }
+    return chunk;
+  }
+
+  template <typename... Args>
+  void fill_back(size_t count, const Args&... args) {
+    try {
+      reserve_back(count);
+      for (size_t i = 0; i < count; ++i) {
+        construct_back(args...);
+      }
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  // Destroys elements in [first, last) without touching start_ and size_.
+  void destroy_range(size_t first, size_t last) noexcept {
+    for (size_t pos = first; pos < last; ++pos) {
+      AllocTraits::destroy(alloc_, slot(pos));
+    }
+  }
+
+  // Moves `count` elements from position `from` to position `to` with
+  // memmove, one contiguous run at a time. The ranges may overlap, and the
+  // target must lie in allocated chunks.
+  void relocate(size_t from, size_t to, size_t count) noexcept {
+    if (from > to) {
+      while (count != 0) {
+        size_t run = std::min(
+            {count, chunk_size - slot_of(from), chunk_size - slot_of(to)});
+        std::memmove(static_cast<void*>(slot(to)), slot(from),
+                     run * sizeof(T));
+        from += run;
+        to += run;
+        count -= run;
+      }
+    } else if (from < to) {
+      while (count != 0) {
+        size_t run = std::min({count, slot_of(from + count - 1) + 1,
+                               slot_of(to + count - 1) + 1});
+        count -= run;
+        std::memmove(static_cast<void*>(slot(to + count)), slot(from + count),
+                     run * sizeof(T));
+      }
+    }
+  }
+
+  // Forgets `count` elements at the front or back that were already
+  // destroyed or relocated, recycling chunks left empty.
+  void drop_front(size_t count) noexcept {
+    size_t old_first = first_node();
+    start_ += count;
+    size_ -= count;
+    for (size_t node = old_first; node < first_node(); ++node) {
+      release_node(node);
+    }
+  }
+
+  void drop_back(size_t count) noexcept {
+    size_t old_end = node_of(start_ + size_ - 1) + 1;
+    size_ -= count;
+    size_t new_end = node_of(start_ + size_ + chunk_size - 1);
+    for (size_t node = new_end; node < old_end; ++node) {
+      release_node(node);
+    }
+  }
+
+  // Inserts `count` elements, each built by `make(place)`, before `index`.
+  template <typename Make>
+  void insert_n(size_t index, size_t count, Make make) {
+    if (count == 0) {
+      return;
+    }
+    detach();
+    if constexpr (opens_gap_first) {
+      bool to_front = index < size_ - index;
+      size_t gap = 0;
+      if (to_front) {
+        reserve_front(count);
+        relocate(start_, start_ - count, index);
+        gap = start_ - count + index;
+      } else {
+        reserve_back(count);
+        relocate(start_ + index, start_ + index + count, size_ - index);
+        gap = start_ + index;
+      }
+      size_t built = 0;
+      try {
+        for (; built < count; ++built) {
+          make(slot(gap + built));
+        }
+      } catch (...) {
+        destroy_range(gap, gap + built);
+        if (to_front) {
+          relocate(start_ - count, start_, index);
+        } else {
+          relocate(start_ + index + count, start_ + index, size_ - index);
+        }
+        throw;
+      }
+      if (to_front) {
+        start_ -= count;
+      }
+      size_ += count;
+    } else if constexpr (rotates_in_place) {
+      bool to_front = index < size_ - index;
+      if (to_front) {
+        reserve_front(count);
+      } else {
+        reserve_back(count);
+      }
+      size_t first = to_front ? start_ - count : start_ + size_;
+      size_t built = 0;
+      try {
+        for (; built < count; ++built) {
+          make(slot(first + built));
+        }
+      } catch (...) {
+        destroy_range(first, first + built);
+        throw;
+      }
+      size_t old_size = size_;
+      size_ += count;
+      if (to_front) {
+        start_ -= count;
+        std::rotate(begin(), begin() + count, begin() + count + index);
+      } else {
+        std::rotate(begin() + index, begin() + old_size, end());
+      }
+    } else {
+      Deque rebuilt(alloc_);
+      rebuilt.reserve_back(size_ + count);
+      for (size_t i = 0; i < index; ++i) {
+        rebuilt.construct_back(std::as_const((*this)[i]));
+      }
+      for (size_t i = 0; i < count; ++i) {
+        make(rebuilt.slot(rebuilt.start_ + rebuilt.size_));
+        ++rebuilt.size_;
+      }
+      for (size_t i = index; i < size_; ++i) {
+        rebuilt.construct_back(std::as_const((*this)[i]));
+      }
+      swap(rebuilt);
+    }
+  }
+
+  void release() noexcept {
+    if constexpr (is_cow) {
+      // Chunks still shared are left to their other owners.
+      if (!cow_.detached) {
+        for (size_t node = first_node(); node < end_node(); ++node) {
+          auto [first, last] = live_slots(node);
+          unref_chunk(map_[node], first, last);
+          map_[node] = nullptr;
+        }
+        size_ = 0;
+      }
+      cow_ = {};
+    }
+    destroy_range(start_, start_ + size_);
+    for (size_t node = 0; node < map_size_; ++node) {
+      if (map_[node] != nullptr) {
+        deallocate_chunk(map_[node]);
+      }
+    }
+    while (spare_count_ != 0) {
+      deallocate_chunk(spare_chunks_[--spare_count_]);
+    }
+    deallocate_map(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    start_ = 0;
+    size_ = 0;
+  }
+
+  [[no_unique_address]] Alloc alloc_;
+  T** map_ = nullptr;
+  size_t map_size_ = 0;
+  size_t start_ = 0;
+  size_t size_ = 0;
+  T* spare_chunks_[spare_chunk_limit] = {};
+  size_t spare_count_ = 0;
+  [[no_unique_address]] std::conditional_t<is_cow, CowFlags, NoCowFlags> cow_;
+  [[no_unique_address]] std::conditional_t<has_inline, InlineStorage,
+                                           NoInlineStorage> inline_;
+};
+
+template <typename T, typename Alloc, typename ChunkPolicy>
+template <bool IsConst>
+class Deque<T, Alloc, ChunkPolicy>::BaseIterator {
+ public:
+  using iterator_category = std::random_access_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = std::conditional_t<IsConst, const T*, T*>;
+  using reference = std::conditional_t<IsConst, const T&, T&>;
+
+  BaseIterator() = default;
+
+  operator BaseIterator<true>() const
+    requires(!IsConst)
+  {
+    BaseIterator<true> copy;
+    copy.node_ = node_;
+    copy.cur_ = cur_;
+    copy.first_ = first_;
+    copy.last_ = last_;
+    return copy;
+  }
+
+  reference operator*() const {
+    return *cur_;
+  }
+
+  pointer operator->() const {
+    return cur_;
+  }
+
+  reference operator[](difference_type n) const {
+    return *(*this + n);
+  }
+
+  BaseIterator& operator++() {
+    if (++cur_ == last_) {
+      set_node(node_ + 1);
+      cur_ = first_;
+    }
+    return *this;
+  }
+
+  BaseIterator operator++(int) {
+    BaseIterator copy = *this;
+    ++*this;
+    return copy;
+  }
+
+  BaseIterator& operator--() {
+    if (cur_ == first_) {
+      set_node(node_ - 1);
+      cur_ = last_;
+    }
+    --cur_;
+    return *this;
+  }
+
+  BaseIterator operator--(int) {
+    BaseIterator copy = *this;
+    --*this;
+    return copy;
+  }
+
+  BaseIterator& operator+=(difference_type n) {
+    difference_type pos = (cur_ - first_) + n;
+    if (pos >= 0 && pos < stride) {
+      cur_ += n;
+      return *this;
+    }
+    difference_type shift =
+        pos >= 0 ? pos / stride : -((-pos - 1) / stride) - 1;
+    set_node(node_ + shift);
+    cur_ = first_ + (pos - shift * stride);
+    return *this;
+  }
+
+  BaseIterator& operator-=(difference_type n) {
+    return *this += -n;
+  }
+
+  friend BaseIterator operator+(BaseIterator it, difference_type n) {
+    return it += n;
+  }
+
+  friend BaseIterator operator+(difference_type n, BaseIterator it) {
+    return it += n;
+  }
+
+  friend BaseIterator operator-(BaseIterator it, difference_type n) {
+    return it -= n;
+  }
+
+  friend difference_type operator-(const BaseIterator& lhs,
+                                   const BaseIterator& rhs) {
+    return (lhs.node_ - rhs.node_) * stride + (lhs.cur_ - lhs.first_) -
+           (rhs.cur_ - rhs.first_);
+  }
+
+  // Within one deque every position has its own address: chunks are
+  // distinct, and the end is the only position that can sit in a node
+  // without a chunk.
+  friend bool operator==(const BaseIterator& lhs, const BaseIterator& rhs) {
+    return lhs.cur_ == rhs.cur_;
+  }
+
+  friend std::strong_ordering operator<=>(const BaseIterator& lhs,
+                                          const BaseIterator& rhs) {
+    if (lhs.node_ != rhs.node_) {
+      return lhs.node_ <=> rhs.node_;
+    }
+    return std::compare_three_way()(lhs.cur_, rhs.cur_);
+  }
+
+  // Segment-aware overloads of the standard algorithms, picked by ADL for
+  // unqualified calls. Each runs the plain pointer algorithm chunk by chunk.
+  friend void fill(BaseIterator first, BaseIterator last, const T& value)
+    requires(!IsConst)
+  {
+    visit_pieces(first, last, [&](T* begin, T* end) {
+      std::fill(begin, end, value);
+      return true;
+    });
+  }
+
+  template <typename OutputIt>
+  friend OutputIt copy(BaseIterator first, BaseIterator last, OutputIt out) {
+    visit_pieces(first, last, [&](pointer begin, pointer end) {
+      out = std::copy(begin, end, out);
+      return true;
+    });
+    return out;
+  }
+
+  template <typename Init>
+  friend Init accumulate(BaseIterator first, BaseIterator last, Init init) {
+    visit_pieces(first, last, [&](pointer begin, pointer end) {
+      init = std::accumulate(begin, end, std::move(init));
+      return true;
+    });
+    return init;
+  }
+
+  template <typename Init, typename BinaryOp>
+  friend Init accumulate(BaseIterator first, BaseIterator last, Init init,
+                         BinaryOp op) {
+    visit_pieces(first, last, [&](pointer begin, pointer end) {
+      init = std::accumulate(begin, end, std::move(init), op);
+      return true;
+    });
+    return init;
+  }
+
+  template <typename U>
+  friend BaseIterator find(BaseIterator first, BaseIterator last,
+                           const U& value) {
+    BaseIterator result = last;
+    difference_type skipped = 0;
+    visit_pieces(first, last, [&](pointer begin, pointer end) {
+      pointer hit = std::find(begin, end, value);
+      if (hit != end) {
+        result = first + (skipped + (hit - begin));
+        return false;
+      }
+      skipped += end - begin;
+      return true;
+    });
+    return result;
+  }
+
+  template <typename F>
+  friend F for_each(BaseIterator first, BaseIterator last, F f) {
+    visit_pieces(first, last, [&](pointer begin, pointer end) {
+      std::for_each(begin, end, std::ref(f));
+      return true;
+    });
+    return f;
+  }
+
+ private:
+  friend class Deque;
+  friend class BaseIterator<!IsConst>;
+
+  static constexpr difference_type stride = chunk_size;
+
+  // Loads the bounds of the chunk at `node`. The node past the last element
+  // may have no chunk; an iterator there gets an empty stand-in, and only
+  // ever gets compared, measured or stepped back.
+  void set_node(T** node) {
+    node_ = node;
+    if (*node != nullptr) {
+      first_ = *node;
+      last_ = first_ + stride;
+    } else {
+      first_ = no_chunk();
+      last_ = first_;
+    }
+  }
+
+  // Calls `visit(begin, end)` with pointer bounds of each contiguous piece of
+  // [first, last) in order, stopping as soon as it returns false.
+  template <typename Visit>
+  static void visit_pieces(BaseIterator first, BaseIterator last,
+                           Visit visit) {
+    while (first.node_ != last.node_) {
+      if (!visit(first.cur_, first.last_)) {
+        return;
+      }
+      first.set_node(first.node_ + 1);
+      first.cur_ = first.first_;
+    }
+    if (first.cur_ != last.cur_) {
+      visit(first.cur_, last.cur_);
+    }
+  }
+
+  BaseIterator(T** node, difference_type offset) {
+    set_node(node);
+    cur_ = first_ + offset;
+  }
+
+  // The element and the bounds of its chunk are cached, so stepping and
+  // dereferencing within a chunk never go through the map.
+  pointer cur_ = nullptr;
+  pointer first_ = nullptr;
+  pointer last_ = nullptr;
+  T** node_ = nullptr;
+};
+
+template <typename T, typename Alloc, typename ChunkPolicy>
+template <bool IsConst>
+class Deque<T, Alloc, ChunkPolicy>::SegmentRange {
+ public:
+  using segment = std::span<std::conditional_t<IsConst, const T, T>>;
+
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = segment;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = segment;
+
+    Iterator() = default;
+
+    segment operator*() const {
+      auto end = pos_.node_ == last_.node_ ? last_.cur_ : pos_.last_;
+      return segment(pos_.cur_, end);
+    }
+
+    Iterator& operator++() {
+      if (pos_.node_ == last_.node_) {
+        pos_ = last_;
+      } else {
+        pos_.set_node(pos_.node_ + 1);
+        pos_.cur_ = pos_.first_;
+      }
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+      return lhs.pos_ == rhs.pos_;
+    }
+
+   private:
+    friend class SegmentRange;
+
+    Iterator(BaseIterator<IsConst> pos, BaseIterator<IsConst> last)
+        : pos_(pos),
+          last_(last) {
+    }
+
+    BaseIterator<IsConst> pos_;
+    BaseIterator<IsConst> last_;
+  };
+
+  Iterator begin() const {
+    return Iterator(first_, last_);
+  }
+
+  Iterator end() const {
+    return Iterator(last_, last_);
+  }
+
+ private:
+  friend class Deque;
+
+  SegmentRange(BaseIterator<IsConst> first, BaseIterator<IsConst> last)
+      : first_(first),
+        last_(last) {
+  }
+
+  BaseIterator<IsConst> first_;
+  BaseIterator<IsConst> last_;
+};
+
+template <typename T, size_t N, typename Alloc = std::allocator<T>>
+using BoundedDeque = Deque<T, Alloc, Bounded<N>>;
+
+template <typename T, size_t N, typename Alloc = std::allocator<T>>
+using SmallDeque = Deque<T, Alloc, InlineFirstChunk<N>>;
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "deque.h"
+
+namespace {
+
+struct Wide {
+  explicit Wide(int value)
+      : value(value) {
+  }
+
+  int value;
+  char payload[252] = {};
+};
+
+template <typename T>
+T make_value(int value) {
+  return T(value);
+}
+
+// The test2 pattern scaled up: grow at both ends, then drain the front.
+template <typename D>
+size_t oscillate(D& d) {
+  size_t checksum = 0;
+  for (int round = 0; round < 50'000; ++round) {
+    for (int i = 0; i < 8; ++i) {
+      d.push_back(make_value<typename D::value_type>(i));
+      d.push_front(make_value<typename D::value_type>(i));
+    }
+    for (int i = 0; i < 12; ++i) {
+      d.pop_front();
+    }
+    d.pop_back();
+    checksum += d.size();
+  }
+  return checksum;
+}
+
+// The test3 pattern: push two to the front, pop one from the back.
+template <typename D>
+size_t drift(D& d) {
+  for (int i = 0; i < 1000; ++i) {
+    for (int j = 0; j < 1000; ++j) {
+      if (j % 3 == 2) {
+        d.pop_back();
+      } else {
+        d.push_front(make_value<typename D::value_type>(i * j));
+      }
+    }
+  }
+  return d.size();
+}
+
+// Steady-state FIFO: every chunk emptied at the front is needed again at the
+// back shortly after.
+template <typename D>
+size_t queue(D& d) {
+  size_t checksum = 0;
+  for (int i = 0; i < 1000; ++i) {
+    d.push_back(make_value<typename D::value_type>(i));
+  }
+  for (int i = 0; i < 2'000'000; ++i) {
+    d.push_back(make_value<typename D::value_type>(i));
+    d.pop_front();
+    checksum += d.size();
+  }
+  return checksum;
+}
+
+template <typename D, typename Pattern>
+int64_t measure(Pattern pattern, size_t& checksum) {
+  using std::chrono::steady_clock;
+  int64_t best = 0;
+  for (int run = 0; run < 3; ++run) {
+    D d;
+    auto start = steady_clock::now();
+    checksum += pattern(d);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - start);
+    if (run == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+  return best;
+}
+
+template <typename T, typename Policy>
+void sweep_one(const std::string& type_name, const std::string& policy_name,
+               size_t& checksum) {
+  using D = Deque<T, std::allocator<T>, Policy>;
+  int64_t oscillate_us = measure<D>(oscillate<D>, checksum);
+  int64_t drift_us = measure<D>(drift<D>, checksum);
+  int64_t queue_us = measure<D>(queue<D>, checksum);
+  std::cerr << type_name << " " << policy_name << " ("
+            << Policy::template chunk_size<T> << " per chunk): oscillate "
+            << oscillate_us << " us, drift " << drift_us << " us, queue "
+            << queue_us << " us" << std::endl;
+}
+
+template <typename T>
+void sweep(const std::string& type_name, size_t& checksum) {
+  sweep_one<T, ChunkBytes<256>>(type_name, "ChunkBytes<256>", checksum);
+  sweep_one<T, ChunkBytes<1024>>(type_name, "ChunkBytes<1024>", checksum);
+  sweep_one<T, ChunkBytes<4096>>(type_name, "ChunkBytes<4096>", checksum);
+  sweep_one<T, ChunkBytes<16384>>(type_name, "ChunkBytes<16384>", checksum);
+  sweep_one<T, ChunkBytes<65536>>(type_name, "ChunkBytes<65536>", checksum);
+  sweep_one<T, DefaultChunkSize>(type_name, "DefaultChunkSize", checksum);
+}
+
+template <typename F>
+int64_t time_scan(F scan, int64_t& checksum) {
+  using std::chrono::steady_clock;
+  int64_t best = 0;
+  for (int run = 0; run < 5; ++run) {
+    auto start = steady_clock::now();
+    checksum += scan();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - start);
+    if (run == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+  return best;
+}
+
+// Sums a multi-million-element deque element by element, through the
+// segmented overloads and through raw spans, against a std::vector baseline.
+void scan(size_t& checksum) {
+  constexpr int count = 8'000'000;
+  Deque<int> d;
+  std::vector<int> v;
+  for (int i = 0; i < count; ++i) {
+    d.push_back(i % 1000);
+    v.push_back(i % 1000);
+  }
+  int64_t sum = 0;
+  int64_t iterator_us = time_scan(
+      [&] { return std::accumulate(d.begin(), d.end(), int64_t{0}); }, sum);
+  int64_t segmented_us = time_scan(
+      [&] { return accumulate(d.begin(), d.end(), int64_t{0}); }, sum);
+  int64_t spans_us = time_scan(
+      [&] {
+        int64_t total = 0;
+        d.for_each_segment([&](std::span<int> segment) {
+          for (int x : segment) {
+            total += x;
+          }
+        });
+        return total;
+      },
+      sum);
+  int64_t vector_us = time_scan(
+      [&] { return std::accumulate(v.begin(), v.end(), int64_t{0}); }, sum);
+  std::cerr << "sum of " << count << " ints: iterators " << iterator_us
+            << " us, segmented accumulate " << segmented_us
+            << " us, for_each_segment " << spans_us << " us, std::vector "
+            << vector_us << " us" << std::endl;
+  checksum += static_cast<size_t>(sum);
+}
+
+// Walks a cache-resident deque with hand-written iterator loops (forward,
+// backward and in strides) against the same loops over raw pointers into a
+// std::vector. The loop bodies carry a light serial dependency so neither
+// side is vectorized and the cost of stepping is what gets measured.
+template <typename It>
+int64_t walk_forward(It first, It last) {
+  int64_t hash = 0;
+  for (; first != last; ++first) {
+    hash += *first ^ (hash >> 16);
+  }
+  return hash;
+}
+
+template <typename It>
+int64_t walk_backward(It first, It last) {
+  int64_t hash = 0;
+  while (last != first) {
+    --last;
+    hash += *last ^ (hash >> 16);
+  }
+  return hash;
+}
+
+template <typename It>
+int64_t walk_strided(It first, It last) {
+  constexpr int64_t stride = 7;
+  int64_t hash = 0;
+  for (int64_t offset = 0; offset < stride; ++offset) {
+    for (It it = first + offset; last - it > stride; it += stride) {
+      hash += *it ^ (hash >> 16);
+    }
+  }
+  return hash;
+}
+
+template <typename Walk>
+int64_t repeat_walk(Walk walk) {
+  int64_t hash = 0;
+  for (int round = 0; round < 200; ++round) {
+    hash += walk();
+  }
+  return hash;
+}
+
+void traverse(size_t& checksum) {
+  constexpr int count = 64 * 1024;
+  Deque<int> d;
+  std::vector<int> v;
+  for (int i = 0; i < count; ++i) {
+    d.push_back(i % 1000);
+    v.push_back(i % 1000);
+  }
+  const int* first = v.data();
+  const int* last = v.data() + v.size();
+  int64_t sum = 0;
+  auto report = [&](const char* name, auto deque_walk, auto raw_walk) {
+    int64_t deque_us = time_scan([&] { return repeat_walk(deque_walk); }, sum);
+    int64_t raw_us = time_scan([&] { return repeat_walk(raw_walk); }, sum);
+    std::cerr << name << " walks of " << count << " ints x 200: iterators "
+              << deque_us << " us, raw pointers " << raw_us << " us"
+              << std::endl;
+  };
+  report(
+      "forward", [&] { return walk_forward(d.cbegin(), d.cend()); },
+      [&] { return walk_forward(first, last); });
+  report(
+      "backward", [&] { return walk_backward(d.cbegin(), d.cend()); },
+      [&] { return walk_backward(first, last); });
+  report(
+      "strided", [&] { return walk_strided(d.cbegin(), d.cend()); },
+      [&] { return walk_strided(first, last); });
+  checksum += static_cast<size_t>(sum);
+}
+
+template <typename D>
+int64_t fill_strings(size_t& checksum) {
+  using std::chrono::steady_clock;
+  auto start = steady_clock::now();
+  D d;
+  for (int i = 0; i < 1'000'000; ++i) {
+    d.push_back(std::string(32, static_cast<char>('a' + i % 26)));
+  }
+  d.emplace_back(40, 'z');
+  checksum += d.back().size();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             steady_clock::now() - start)
+      .count();
+}
+
+template <typename D>
+int64_t insert_middle(size_t& checksum) {
+  using std::chrono::steady_clock;
+  D d;
+  for (int i = 0; i < 200'000; ++i) {
+    d.push_back(i);
+  }
+  auto start = steady_clock::now();
+  for (int i = 0; i < 2'000; ++i) {
+    d.insert(d.begin() + static_cast<int64_t>(d.size() / 3), i);
+    d.erase(d.begin() + static_cast<int64_t>(d.size() * 2 / 3));
+  }
+  checksum += static_cast<size_t>(d[d.size() / 3]);
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             steady_clock::now() - start)
+      .count();
+}
+
+template <typename F>
+int64_t best_of_three(F run) {
+  int64_t best = run();
+  for (int i = 0; i < 2; ++i) {
+    best = std::min(best, run());
+  }
+  return best;
+}
+
+// Element moves against std::deque: string payloads pushed by move, and
+// middle insert/erase of ints, which Deque shifts with memmove.
+void payloads(size_t& checksum) {
+  int64_t strings_us = best_of_three(
+      [&] { return fill_strings<Deque<std::string>>(checksum); });
+  int64_t std_strings_us = best_of_three(
+      [&] { return fill_strings<std::deque<std::string>>(checksum); });
+  std::cerr << "1M moved strings: Deque " << strings_us << " us, std::deque "
+            << std_strings_us << " us" << std::endl;
+  int64_t middle_us = best_of_three(
+      [&] { return insert_middle<Deque<int>>(checksum); });
+  int64_t std_middle_us = best_of_three(
+      [&] { return insert_middle<std::deque<int>>(checksum); });
+  std::cerr << "2000 middle insert+erase on 200K ints: Deque " << middle_us
+            << " us, std::deque " << std_middle_us << " us" << std::endl;
+}
+
+// Per-operation latency of a steady FIFO at a fixed length: the unbounded
+// deque occasionally recentres or grows its map, the bounded one only
+// rotates its ring.
+template <typename D>
+void ingest(const std::string& name, size_t& checksum) {
+  using std::chrono::steady_clock;
+  constexpr int length = 4'000;
+  constexpr int ops = 2'000'000;
+  D d;
+  for (int i = 0; i < length; ++i) {
+    d.push_back(i);
+  }
+  std::vector<int64_t> latencies(ops);
+  for (int i = 0; i < ops; ++i) {
+    auto start = steady_clock::now();
+    d.push_back(i);
+    d.pop_front();
+    latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       steady_clock::now() - start)
+                       .count();
+  }
+  checksum += static_cast<size_t>(d.front());
+  std::sort(latencies.begin(), latencies.end());
+  std::cerr << name << " push+pop at length " << length << ": p50 "
+            << latencies[ops / 2] << " ns, p99.9 "
+            << latencies[ops - ops / 1000] << " ns, max " << latencies.back()
+            << " ns" << std::endl;
+}
+
+// Short-lived small deques, like per-connection queues: build one, push
+// `count` elements, drain it as a queue and let it go.
+template <typename D>
+int64_t small_queues(int count, size_t& checksum) {
+  using std::chrono::steady_clock;
+  constexpr int rounds = 200'000;
+  auto start = steady_clock::now();
+  for (int round = 0; round < rounds; ++round) {
+    D d;
+    for (int i = 0; i < count; ++i) {
+      d.push_back(round + i);
+    }
+    while (!d.empty()) {
+      checksum += static_cast<size_t>(d.front());
+      d.pop_front();
+    }
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             steady_clock::now() - start)
+             .count() /
+         rounds;
+}
+
+void small_sizes(size_t& checksum) {
+  for (int count : {1, 2, 4, 8, 16, 32, 64}) {
+    int64_t heap_ns = best_of_three(
+        [&] { return small_queues<Deque<int>>(count, checksum); });
+    int64_t inline16_ns = best_of_three(
+        [&] { return small_queues<SmallDeque<int, 16>>(count, checksum); });
+    int64_t inline64_ns = best_of_three(
+        [&] { return small_queues<SmallDeque<int, 64>>(count, checksum); });
+    std::cerr << "deque of " << count << " ints, built and drained: Deque "
+              << heap_ns << " ns, SmallDeque<16> " << inline16_ns
+              << " ns, SmallDeque<64> " << inline64_ns << " ns" << std::endl;
+  }
+}
+
+}  // namespace
+
+int main() {
+  size_t checksum = 0;
+  sweep<char>("char", checksum);
+  sweep<int>("int", checksum);
+  sweep<Wide>("Wide", checksum);
+  scan(checksum);
+  traverse(checksum);
+  payloads(checksum);
+  ingest<Deque<int>>("Deque<int>", checksum);
+  ingest<BoundedDeque<int, 4'096>>("BoundedDeque<int, 4096>", checksum);
+  small_sizes(checksum);
+  std::cout << checksum << std::endl;
+}
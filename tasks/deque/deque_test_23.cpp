@@ -6,8 +6,14 @@
 #include <iostream>
 #include <cassert>
 #include <deque>
+#include <atomic>
+#include <span>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include "deque.h"
+#include "work_stealing_deque.h"
 
 #ifndef NO_TEST
 
@@ -675,7 +681,6 @@ namespace TestsByUnrealf1 {
         assert(Explosive::exploded == false);
     }
 
-/*
     void testStrongGuarantee() {
         const size_t size = 20'000;
         const size_t initial_data = 100;
@@ -699,10 +704,598 @@ namespace TestsByUnrealf1 {
             assert(is_intact());
         }
     }
-*/
 
 } // namespace TestsByUnrealf1
 
+namespace ExtraTests {
+
+std::string join(const Deque<int>& d) {
+    std::string s;
+    for (int x : d) {
+        s += std::to_string(x);
+    }
+    return s;
+}
+
+void testRangeInsertAndErase() {
+    Deque<int> d;
+    for (int i = 0; i < 10; ++i) {
+        d.push_back(i);
+    }
+
+    // near the front and near the back shift different sides
+    d.insert(d.begin() + 2, 3, 7);
+    assert(join(d) == "0177723456789");
+    d.insert(d.end() - 2, 2, 8);
+    assert(join(d) == "017772345678889");
+
+    std::vector<int> v = {5, 5};
+    auto it = d.insert(d.begin() + 1, v.begin(), v.end());
+    assert(*it == 5 && it - d.begin() == 1);
+    assert(join(d) == "05517772345678889");
+
+    std::istringstream in("1 2 3");
+    d.insert(d.end() - 1, std::istream_iterator<int>(in), std::istream_iterator<int>());
+    assert(join(d) == "05517772345678881239");
+
+    it = d.erase(d.begin() + 1, d.begin() + 6);
+    assert(*it == 7);
+    assert(join(d) == "072345678881239");
+
+    d.erase(d.end() - 5, d.end() - 1);
+    assert(join(d) == "07234567889");
+    assert(d.erase(d.begin(), d.begin()) == d.begin());
+
+    Deque<int> big;
+    for (int i = 0; i < 100'000; ++i) {
+        big.push_back(i);
+    }
+    big.insert(big.begin() + 50'000, 100'000, -1);
+    assert(big.size() == 200'000);
+    assert(big[49'999] == 49'999 && big[50'000] == -1);
+    assert(big[149'999] == -1 && big[150'000] == 50'000);
+    big.erase(big.begin() + 50'000, big.begin() + 150'000);
+    for (int i = 0; i < 100'000; ++i) {
+        assert(big[i] == i);
+    }
+}
+
+void testSegmentedAlgorithms() {
+    Deque<int> d;
+    for (int i = 0; i < 10'000; ++i) {
+        d.push_front(i);
+    }
+
+    size_t total = 0;
+    size_t pieces = 0;
+    for (auto segment : d.segments()) {
+        total += segment.size();
+        ++pieces;
+    }
+    assert(total == d.size() && pieces > 1);
+
+    long long sum = 0;
+    d.for_each_segment([&](std::span<int> segment) {
+        for (int x : segment) {
+            sum += x;
+        }
+    });
+    assert(sum == 49'995'000LL);
+
+    // ADL picks the segmented overloads for unqualified calls
+    assert(accumulate(d.begin() + 1, d.end() - 1, 0LL) == 49'995'000LL - 9'999);
+    assert(find(d.cbegin(), d.cend(), 1234) - d.cbegin() == 10'000 - 1 - 1234);
+    assert(find(d.begin(), d.end(), -1) == d.end());
+
+    fill(d.begin() + 100, d.end() - 100, 7);
+    assert(d[99] == 9'999 - 99 && d[100] == 7 && d[9'899] == 7 && d[9'900] == 99);
+
+    std::vector<int> out(d.size());
+    copy(d.cbegin(), d.cend(), out.begin());
+    assert(std::equal(out.begin(), out.end(), d.begin()));
+
+    int sevens = 0;
+    for_each(d.begin(), d.end(), [&](int x) { sevens += x == 7; });
+    assert(sevens == 9'800 + 1);
+
+    const Deque<int> empty;
+    for (auto segment : empty.segments()) {
+        std::ignore = segment;
+        assert(false);
+    }
+    assert(find(empty.begin(), empty.end(), 0) == empty.end());
+}
+
+struct AllocationLog {
+    size_t allocations = 0;
+    size_t live = 0;
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    AllocationLog* log;
+
+    explicit CountingAllocator(AllocationLog* log): log(log) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other): log(other.log) {}
+
+    T* allocate(size_t n) {
+        ++log->allocations;
+        ++log->live;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        --log->live;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return log == other.log;
+    }
+};
+
+void testSpareChunks() {
+    AllocationLog log;
+    {
+        Deque<int, CountingAllocator<int>> d{CountingAllocator<int>(&log)};
+        for (int i = 0; i < 100'000; ++i) {
+            d.push_back(i);
+        }
+
+        // a queue that keeps its length reuses the chunks it frees
+        for (int i = 0; i < 100'000; ++i) {
+            d.push_back(i);
+            d.pop_front();
+        }
+        size_t warmed_up = log.allocations;
+        for (int i = 0; i < 1'000'000; ++i) {
+            d.push_back(i);
+            d.pop_front();
+        }
+        assert(log.allocations == warmed_up);
+
+        // and so does one that swings between its ends
+        for (int round = 0; round < 1'000; ++round) {
+            for (int i = 0; i < 3'000; ++i) {
+                d.push_front(i);
+            }
+            for (int i = 0; i < 3'000; ++i) {
+                d.pop_front();
+            }
+        }
+        assert(log.allocations <= warmed_up + 200);
+
+        d.clear();
+        d.shrink_to_fit();
+        assert(log.live == 0);
+
+        d.push_back(1);
+        assert(d.size() == 1 && d.front() == 1);
+    }
+    assert(log.live == 0);
+}
+
+void testBounded() {
+    TestsByUnrealf1::CheckIter<BoundedDeque<int, 100>::iterator, int> iter;
+    std::ignore = iter;
+    TestsByUnrealf1::CheckIter<BoundedDeque<int, 100>::const_iterator, const int> const_iter;
+    std::ignore = const_iter;
+    static_assert(BoundedDeque<int, 100>::capacity() == 100);
+
+    AllocationLog log;
+    {
+        using Ring = Deque<int, CountingAllocator<int>, Bounded<1'000>>;
+        Ring d{CountingAllocator<int>(&log)};
+        size_t preallocated = log.allocations;
+        assert(preallocated > 0);
+
+        // a full FIFO goes round the ring without allocating
+        for (int i = 0; i < 1'000; ++i) {
+            assert(d.try_push_back(i));
+        }
+        assert(!d.try_push_back(-1) && !d.try_push_front(-1));
+        for (int i = 1'000; i < 1'000'000; ++i) {
+            assert(d.front() == i - 1'000);
+            d.pop_front();
+            d.push_back(i);
+        }
+        assert(d.size() == 1'000 && d.back() == 999'999);
+
+        // and so does one running the other way
+        for (int i = 0; i < 100'000; ++i) {
+            d.pop_back();
+            assert(d.try_push_front(i));
+        }
+        assert(d.front() == 99'999 && d[999] == 99'000);
+        assert(log.allocations == preallocated);
+
+        int caught = 0;
+        try {
+            d.push_back(0);
+        } catch (std::length_error&) {
+            ++caught;
+        }
+        try {
+            d.insert(d.begin() + 500, 1, 0);
+        } catch (std::length_error&) {
+            ++caught;
+        }
+        assert(caught == 2 && d.size() == 1'000 && d.front() == 99'999);
+
+        d.erase(d.begin() + 100, d.begin() + 900);
+        d.insert(d.begin() + 50, 800, 7);
+        assert(d.size() == 1'000 && d[50] == 7 && d[849] == 7 && d[850] == 99'949);
+        std::sort(d.begin(), d.end());
+        assert(std::is_sorted(d.begin(), d.end()));
+        d.shrink_to_fit();
+        d.clear();
+        assert(log.allocations == preallocated);
+    }
+    assert(log.live == 0);
+
+    BoundedDeque<std::string, 3> small;
+    small.push_back("b");
+    small.push_front("a");
+    small.push_back("c");
+    assert(!small.try_push_front("z"));
+    BoundedDeque<std::string, 3> copy = small;
+    BoundedDeque<std::string, 3> moved = std::move(small);
+    assert(copy.size() == 3 && moved.front() == "a" && moved.back() == "c");
+    small = copy;
+    assert(small[1] == "b");
+}
+
+void testCopyOnWrite() {
+    AllocationLog log;
+    {
+        using Cow = Deque<std::string, CountingAllocator<std::string>, CopyOnWrite<>>;
+        Cow d{CountingAllocator<std::string>(&log)};
+        for (int i = 0; i < 10'000; ++i) {
+            d.push_back(std::to_string(i));
+        }
+        const Cow& view = d;
+
+        // a copy shares every chunk and only allocates its map
+        size_t before = log.allocations;
+        Cow snapshot = d;
+        assert(log.allocations == before + 1);
+
+        // writing at one end clones just the chunk written to
+        d.push_back("new");
+        d.pop_front();
+        assert(log.allocations <= before + 3);
+        assert(snapshot.size() == 10'000 && std::as_const(snapshot).front() == "0");
+        assert(view.size() == 10'000 && view.front() == "1" && view.back() == "new");
+
+        // mutable access unshares the chunk it reaches
+        snapshot[5'000] = "changed";
+        assert(view[4'999] == "5000" && std::as_const(snapshot)[5'000] == "changed");
+
+        // and a deque that handed out references copies its elements
+        before = log.allocations;
+        Cow deep = snapshot;
+        assert(log.allocations > before + 10);
+        snapshot[0] = "mine";
+        assert(std::as_const(deep)[0] == "0");
+
+        Cow chain = view;
+        Cow chain2 = chain;
+        chain.clear();
+        assert(chain2.size() == view.size());
+        assert(std::equal(std::as_const(chain2).begin(), std::as_const(chain2).end(),
+                          view.begin()));
+        for (auto& value : chain2) {
+            value += "!";
+        }
+        assert(view.front() == "1" && std::as_const(chain2).front() == "1!");
+    }
+    assert(log.live == 0);
+    {
+        using Cow = Deque<std::string, CountingAllocator<std::string>, CopyOnWrite<>>;
+        Cow source{CountingAllocator<std::string>(&log)};
+        for (int i = 0; i < 1'000; ++i) {
+            source.push_back(std::to_string(i));
+        }
+
+        // references taken through const access survive the copy's writes
+        // and the copy's death, as the copy clones what it writes to
+        const std::string& first = std::as_const(source)[0];
+        Cow::const_iterator middle = std::as_const(source).begin() + 500;
+        Cow* copy = new Cow(source);
+        (*copy)[0] = "copy-write";
+        (*copy)[500] = "copy-write";
+        assert(first == "0" && *middle == "500");
+        delete copy;
+        assert(first == "0" && *middle == "500");
+
+        // references taken through non-const access survive copies and
+        // writes on either side
+        std::string& held = source[0];
+        Cow::iterator it = source.begin() + 500;
+        copy = new Cow(source);
+        source[0] = "written";
+        *it = "written too";
+        assert(held == "written" && std::as_const(*copy)[0] == "0");
+        assert(std::as_const(*copy)[500] == "500");
+        (*copy)[0] = "copy-write";
+        (*copy)[500] = "copy-write";
+        assert(held == "written" && *it == "written too");
+        delete copy;
+        assert(held == "written" && *it == "written too");
+    }
+    assert(log.live == 0);
+    {
+        // copying reads the source only, so a const deque can be copied from
+        // several threads at once
+        using Cow = Deque<int, std::allocator<int>, CopyOnWrite<>>;
+        Cow source;
+        for (int i = 0; i < 10'000; ++i) {
+            source.push_back(i);
+        }
+        const Cow& view = source;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&view, t] {
+                for (int round = 0; round < 1'000; ++round) {
+                    Cow copy = view;
+                    copy[t] = -1;
+                    assert(std::as_const(copy)[t] == -1 && view[t] == t);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(std::equal(view.begin(), view.end(), Cow(view).begin()));
+    }
+}
+
+void testInlineFirstChunk() {
+    AllocationLog log;
+    {
+        using Small = SmallDeque<int, 16, CountingAllocator<int>>;
+        Small d{CountingAllocator<int>(&log)};
+        for (int round = 0; round < 100; ++round) {
+            for (int i = 0; i < 8; ++i) {
+                d.push_back(i);
+                d.push_front(-i);
+            }
+            assert(d.size() == 16 && d.front() == -7 && d.back() == 7);
+            d.erase(d.begin() + 3);
+            d.insert(d.begin() + 3, 42);
+            while (!d.empty()) {
+                d.pop_back();
+            }
+        }
+        // a queue of up to 16 keeps crossing chunk boundaries
+        for (int i = 0; i < 10'000; ++i) {
+            d.push_back(i);
+            if (d.size() == 16) {
+                assert(d.front() == i - 15);
+                d.pop_front();
+            }
+        }
+        d.clear();
+        assert(log.allocations == 0);
+
+        // outgrowing the inline chunk goes to the heap as usual
+        for (int i = 0; i < 1'000; ++i) {
+            d.push_back(i);
+        }
+        assert(log.allocations > 0);
+        assert(d.size() == 1'000 && d[999] == 999);
+        Small moved = std::move(d);
+        assert(moved.size() == 1'000 && moved[500] == 500 && d.empty());
+        moved.clear();
+        moved.shrink_to_fit();
+        assert(log.live == 0);
+    }
+    assert(log.live == 0);
+
+    // moves and swaps carry the inline elements over
+    using Strings = SmallDeque<std::string, 8>;
+    Strings small;
+    for (int i = 0; i < 6; ++i) {
+        small.push_back(std::string(30, 'a' + i));
+    }
+    Strings large;
+    for (int i = 0; i < 100; ++i) {
+        large.push_front(std::to_string(i));
+    }
+    Strings copy = small;
+    small.swap(large);
+    assert(small.size() == 100 && small.front() == "99" && small.back() == "0");
+    assert(large.size() == 6 && large[5] == std::string(30, 'f'));
+    assert(std::equal(large.begin(), large.end(), copy.begin(), copy.end()));
+    Strings other = std::move(large);
+    assert(other.size() == 6 && other.front() == std::string(30, 'a'));
+    large = std::move(small);
+    small = other;
+    assert(large.size() == 100 && small.size() == 6 && other.size() == 6);
+    std::swap(small, large);
+    assert(large.back() == std::string(30, 'f') && small[50] == "49");
+}
+
+// Counting allocators do not propagate, so each deque keeps its own through
+// swaps and assignments, even when the allocators compare unequal.
+template <typename D>
+void checkAllocatorsStay() {
+    AllocationLog first_log;
+    AllocationLog second_log;
+    {
+        CountingAllocator<int> first(&first_log);
+        CountingAllocator<int> second(&second_log);
+        D a(first);
+        D b(second);
+        for (int i = 0; i < 1'000; ++i) {
+            a.push_back(i);
+        }
+        for (int i = 0; i < 10; ++i) {
+            b.push_front(i);
+        }
+        a.swap(b);
+        assert(a.get_allocator() == first && b.get_allocator() == second);
+        assert(a.size() == 10 && a.front() == 9);
+        assert(b.size() == 1'000 && b[999] == 999);
+        // swapped back, so that each deque frees what it allocated
+        a.swap(b);
+        assert(a.size() == 1'000 && b.size() == 10);
+
+        b = a;
+        assert(b.get_allocator() == second);
+        assert(b.size() == 1'000 && b[500] == 500);
+        b.push_back(-1);
+        a = std::move(b);
+        assert(a.get_allocator() == first);
+        assert(a.size() == 1'001 && a.back() == -1);
+    }
+    assert(first_log.live == 0 && second_log.live == 0);
+}
+
+void testAllocatorPropagation() {
+    checkAllocatorsStay<Deque<int, CountingAllocator<int>>>();
+    checkAllocatorsStay<SmallDeque<int, 16, CountingAllocator<int>>>();
+}
+
+// Owns a heap buffer but never points into itself, so memmove is a valid move.
+struct Boxed {
+    std::unique_ptr<int> value;
+
+    explicit Boxed(int x): value(std::make_unique<int>(x)) {}
+    Boxed(const Boxed& other): value(std::make_unique<int>(*other.value)) {}
+    Boxed(Boxed&&) noexcept = default;
+    Boxed& operator=(const Boxed& other) {
+        *value = *other.value;
+        return *this;
+    }
+    Boxed& operator=(Boxed&&) noexcept = default;
+};
+
+} // namespace ExtraTests
+
+template <>
+struct IsTriviallyRelocatable<ExtraTests::Boxed> : std::true_type {};
+
+namespace ExtraTests {
+
+std::string join(const Deque<Boxed>& d) {
+    std::string s;
+    for (const auto& x : d) {
+        s += std::to_string(*x.value);
+    }
+    return s;
+}
+
+void testEmplaceAndRelocation() {
+    Deque<TestsByMesyarik::NotDefaultConstructible> ndc;
+    ndc.emplace_back(TestsByMesyarik::VerySpecialType(1));
+    ndc.emplace_front(TestsByMesyarik::VerySpecialType(0));
+    ndc.emplace(ndc.begin() + 1, TestsByMesyarik::VerySpecialType(5));
+    assert(ndc.size() == 3 && ndc[0].x == 0 && ndc[1].x == 5 && ndc[2].x == 1);
+
+    Deque<std::string> strings;
+    std::string moved = "a long enough string to live on the heap";
+    strings.push_back(std::move(moved));
+    strings.emplace_back(3, 'x');
+    strings.emplace(strings.begin() + 1, "mid");
+    assert(strings[1] == "mid" && strings[2] == "xxx");
+
+    Deque<Boxed> d;
+    for (int i = 0; i < 10; ++i) {
+        d.emplace_back(i);
+    }
+    d.emplace(d.begin() + 3, 7);
+    d.insert(d.end() - 2, d[0]);
+    d.insert(d.begin() + 2, 2, d[1]);
+    assert(join(d) == "01112734567089");
+
+    d.erase(d.begin() + 1, d.begin() + 4);
+    d.erase(d.end() - 4, d.end() - 2);
+    assert(join(d) == "027345689");
+
+    Deque<int> ints;
+    for (int i = 0; i < 100'000; ++i) {
+        ints.push_back(i);
+    }
+    ints.insert(ints.begin() + 1'000, 5'000, ints[3]);
+    ints.insert(ints.end() - 1'000, 5'000, -1);
+    assert(ints.size() == 110'000);
+    assert(ints[999] == 999 && ints[1'000] == 3 && ints[5'999] == 3);
+    assert(ints[6'000] == 1'000 && ints[104'000] == -1 && ints[109'000] == 99'000);
+    ints.erase(ints.begin() + 1'000, ints.begin() + 6'000);
+    ints.erase(ints.end() - 6'000, ints.end() - 1'000);
+    for (int i = 0; i < 100'000; ++i) {
+        assert(ints[i] == i);
+    }
+}
+
+void testWorkStealing() {
+    WorkStealingDeque<int> d;
+    assert(d.empty() && !d.pop() && !d.steal());
+    for (int i = 0; i < 10'000; ++i) {
+        d.push(i);
+    }
+    assert(d.size() == 10'000);
+    assert(*d.steal() == 0 && *d.steal() == 1);
+    assert(*d.pop() == 9'999 && *d.pop() == 9'998);
+    while (d.steal()) {
+    }
+    assert(d.empty());
+    // Wrap the ring around many times with a fixed window of live values.
+    for (int i = 0; i < 100; ++i) {
+        d.push(i);
+    }
+    for (int i = 100; i < 100'100; ++i) {
+        d.push(i);
+        assert(*d.steal() == i - 100);
+    }
+    for (int i = 100'099; i >= 100'000; --i) {
+        assert(*d.pop() == i);
+    }
+    assert(d.empty() && !d.pop());
+
+    // Every value is taken exactly once, by the owner or by a thief.
+    constexpr int count = 200'000;
+    WorkStealingDeque<int> shared;
+    std::vector<std::atomic<int>> taken(count);
+    std::atomic<bool> done = false;
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.emplace_back([&] {
+            while (!done.load()) {
+                if (auto value = shared.steal()) {
+                    taken[*value].fetch_add(1);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < count; ++i) {
+        shared.push(i);
+        if (i % 3 == 0) {
+            if (auto value = shared.pop()) {
+                taken[*value].fetch_add(1);
+            }
+        }
+    }
+    while (auto value = shared.pop()) {
+        taken[*value].fetch_add(1);
+    }
+    done = true;
+    for (auto& thief : thieves) {
+        thief.join();
+    }
+    for (int i = 0; i < count; ++i) {
+        assert(taken[i].load() == 1);
+    }
+}
+
+} // namespace ExtraTests
+
 int main() {
     
     // static_assert(!std::is_same_v<std::deque<TestsByMesyarik::VerySpecialType>,
@@ -726,13 +1319,23 @@ int main() {
     TestsByUnrealf1::testOperatorSubscript();
     TestsByUnrealf1::testStaticAssertsAccess();
     TestsByUnrealf1::testStaticAssertsIterators();
-    // TestsByUnrealf1::testIteratorsArithmetic();
+    TestsByUnrealf1::testIteratorsArithmetic();
     TestsByUnrealf1::testIteratorsComparison();
     TestsByUnrealf1::testIteratorsAlgorithms();
     TestsByUnrealf1::testPushAndPop();
     TestsByUnrealf1::testInsertAndErase();
     TestsByUnrealf1::testExceptions();
-    //TestsByUnrealf1::testStrongGuarantee();
+    TestsByUnrealf1::testStrongGuarantee();
+
+    ExtraTests::testRangeInsertAndErase();
+    ExtraTests::testSegmentedAlgorithms();
+    ExtraTests::testSpareChunks();
+    ExtraTests::testBounded();
+    ExtraTests::testCopyOnWrite();
+    ExtraTests::testInlineFirstChunk();
+    ExtraTests::testAllocatorPropagation();
+    ExtraTests::testEmplaceAndRelocation();
+    ExtraTests::testWorkStealing();
 
     std::cout << 0;
 }
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "work_stealing_deque.h"
+
+namespace {
+
+// Stand-in for a task body, so that thieves and the owner do not spend all
+// their time fighting over the same cache lines.
+uint64_t work(uint64_t value) {
+  for (int i = 0; i < 16; ++i) {
+    value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  return value;
+}
+
+struct Result {
+  int64_t pops;
+  int64_t steals;
+  double seconds;
+  uint64_t checksum;
+};
+
+// One owner pushes bursts of tasks and works through them from the bottom
+// while `thieves` threads steal from the top until every task is done.
+Result run(int thieves, int64_t tasks) {
+  WorkStealingDeque<int64_t> d;
+  std::atomic<int64_t> remaining = tasks;
+  std::atomic<int64_t> steals = 0;
+  std::atomic<uint64_t> checksum = 0;
+  std::atomic<bool> start = false;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thieves; ++t) {
+    threads.emplace_back([&] {
+      while (!start.load(std::memory_order_acquire)) {
+      }
+      int64_t stolen = 0;
+      uint64_t sum = 0;
+      while (remaining.load(std::memory_order_relaxed) > 0) {
+        if (auto task = d.steal()) {
+          sum += work(static_cast<uint64_t>(*task));
+          ++stolen;
+          remaining.fetch_sub(1, std::memory_order_relaxed);
+        }
+      }
+      steals += stolen;
+      checksum += sum;
+    });
+  }
+
+  using std::chrono::steady_clock;
+  auto begin = steady_clock::now();
+  start.store(true, std::memory_order_release);
+  constexpr int64_t burst = 256;
+  int64_t pops = 0;
+  uint64_t sum = 0;
+  for (int64_t next = 0; next < tasks;) {
+    for (int64_t end = std::min(next + burst, tasks); next < end; ++next) {
+      d.push(next);
+    }
+    // Keep half of each burst around for the thieves.
+    for (int64_t i = 0; i < burst / 2; ++i) {
+      auto task = d.pop();
+      if (!task) {
+        break;
+      }
+      sum += work(static_cast<uint64_t>(*task));
+      ++pops;
+      remaining.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  while (auto task = d.pop()) {
+    sum += work(static_cast<uint64_t>(*task));
+    ++pops;
+    remaining.fetch_sub(1, std::memory_order_relaxed);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed = steady_clock::now() - begin;
+  return {pops, steals.load(), elapsed.count(), checksum.load() + sum};
+}
+
+}  // namespace
+
+int main() {
+  constexpr int64_t tasks = 20'000'000;
+  int max_thieves =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  uint64_t checksum = 0;
+  for (int thieves = 0; thieves <= max_thieves;
+       thieves = thieves == 0 ? 1 : thieves * 2) {
+    Result result = run(thieves, tasks);
+    std::cerr << thieves << " thieves: " << result.seconds * 1e3 << " ms, "
+              << static_cast<double>(result.pops) / result.seconds
+              << " pops/s, "
+              << static_cast<double>(result.steals) / result.seconds
+              << " steals/s" << std::endl;
+    checksum += result.checksum;
+  }
+  std::cout << checksum << std::endl;
+}
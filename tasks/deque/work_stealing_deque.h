@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "deque.h"
+
+// Chase-Lev work-stealing deque laid out like Deque: elements live in
+// fixed-size chunks reached through a ring of chunk pointers. The owning
+// thread pushes and pops at the bottom without locks; any other thread may
+// steal from the top with a single CAS.
+//
+// Growing doubles the ring of chunk pointers and adds fresh chunks; elements
+// never move, so thieves still reading through an old ring see the same
+// data. Old rings are kept until the deque is destroyed.
+//
+// Slots are read while the owner may be overwriting them (a thief that lost
+// its race discards what it read), so T must be trivially copyable; in
+// practice it is a task pointer or a small handle.
+template <typename T, typename ChunkPolicy = DefaultChunkSize>
+class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "WorkStealingDeque stores trivially copyable values");
+
+ public:
+  WorkStealingDeque() {
+    auto ring = std::make_unique<Ring>(min_chunks);
+    for (size_t i = 0; i < min_chunks; ++i) {
+      ring->chunks[i] = new_chunk();
+    }
+    ring_.store(ring.get(), std::memory_order_relaxed);
+    rings_.push_back(std::move(ring));
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Owner only.
+  void push(T value) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    if (chunk_of(bottom) - chunk_of(top) > ring->mask) {
+      ring = grow(ring, top, bottom);
+    }
+    ring->slot(bottom).store(value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Takes the most recently pushed value.
+  std::optional<T> pop() {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Ring* ring = ring_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    T value = ring->slot(bottom).load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // The last element: race the thieves for it.
+      bool won = top_.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      if (!won) {
+        return std::nullopt;
+      }
+    }
+    return value;
+  }
+
+  // Any thread. Takes the oldest value; returns nothing if the deque looked
+  // empty or another thread took that value first.
+  std::optional<T> steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return std::nullopt;
+    }
+    Ring* ring = ring_.load(std::memory_order_acquire);
+    T value = ring->slot(top).load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  // A snapshot; exact only when no other thread is working on the deque.
+  size_t size() const {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+ private:
+  using Slot = std::atomic<T>;
+
+  static constexpr size_t chunk_size = ChunkPolicy::template chunk_size<T>;
+  static constexpr size_t min_chunks = 4;
+  static_assert(std::has_single_bit(chunk_size),
+                "WorkStealingDeque needs a power-of-two chunk size");
+
+  static constexpr int chunk_shift = std::countr_zero(chunk_size);
+
+  // Keeps the owner's and the thieves' counters on separate cache lines.
+  static constexpr size_t cache_line = 64;
+
+  struct Ring {
+    explicit Ring(size_t chunk_count)
+        : mask(chunk_count - 1),
+          chunks(std::make_unique<Slot*[]>(chunk_count)) {
+    }
+
+    Slot& slot(int64_t index) const {
+      auto pos = static_cast<uint64_t>(index);
+      return chunks[(pos >> chunk_shift) & mask][pos & (chunk_size - 1)];
+    }
+
+    size_t mask;
+    std::unique_ptr<Slot*[]> chunks;
+  };
+
+  static size_t chunk_of(int64_t index) {
+    return static_cast<uint64_t>(index) >> chunk_shift;
+  }
+
+  Slot* new_chunk() {
+    chunks_.push_back(std::make_unique<Slot[]>(chunk_size));
+    return chunks_.back().get();
+  }
+
+  // Builds a ring twice as large holding the same chunks for the live
+  // indices, and fills its other entries with unused and fresh chunks.
+  Ring* grow(Ring* old, int64_t top, int64_t bottom) {
+    size_t old_count = old->mask + 1;
+    auto ring = std::make_unique<Ring>(2 * old_count);
+    std::vector<bool> kept(old_count, false);
+    for (size_t chunk = chunk_of(top); chunk < chunk_of(bottom); ++chunk) {
+      ring->chunks[chunk & ring->mask] = old->chunks[chunk & old->mask];
+      kept[chunk & old->mask] = true;
+    }
+    size_t reused = 0;
+    for (size_t i = 0; i <= ring->mask; ++i) {
+      if (ring->chunks[i] != nullptr) {
+        continue;
+      }
+      while (reused < old_count && kept[reused]) {
+        ++reused;
+      }
+      ring->chunks[i] =
+          reused < old_count ? old->chunks[reused++] : new_chunk();
+    }
+    Ring* raw = ring.get();
+    rings_.push_back(std::move(ring));
+    ring_.store(raw, std::memory_order_release);
+    return raw;
+  }
+
+  alignas(cache_line) std::atomic<int64_t> top_ = 0;
+  alignas(cache_line) std::atomic<int64_t> bottom_ = 0;
+  std::atomic<Ring*> ring_ = nullptr;
+
+  // Owned by the owning thread; freed only with the deque.
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::vector<std::unique_ptr<Slot[]>> chunks_;
+};
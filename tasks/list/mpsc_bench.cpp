@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stackallocator.h"
+
+namespace {
+
+constexpr int64_t event_count = 4'000'000;
+// Every event of a run fits, as the consumer's frees do not give memory
+// back to a stack.
+constexpr size_t arena_size = 256'000'000;
+
+// The funnel MpscQueue replaces: a List behind a mutex, which the
+// consumer empties in one splice per lock.
+template <typename Alloc>
+class LockedList {
+ public:
+  explicit LockedList(const Alloc& alloc)
+      : list_(alloc) {
+  }
+
+  void push(int64_t value) {
+    std::lock_guard lock(mutex_);
+    list_.push_back(value);
+  }
+
+  size_t drain_into(List<int64_t, Alloc>& list) {
+    std::lock_guard lock(mutex_);
+    size_t count = list_.size();
+    list.splice(list.end(), list_);
+    return count;
+  }
+
+ private:
+  std::mutex mutex_;
+  List<int64_t, Alloc> list_;
+};
+
+template <typename Alloc>
+using Queue = MpscQueue<int64_t, Alloc>;
+
+struct Result {
+  double seconds;
+  uint64_t checksum;
+};
+
+// `producers` threads push event_count events between them while the main
+// thread drains them into a batch list, sums and frees them.
+template <template <typename> class Funnel, typename Alloc>
+Result run(int producers, const Alloc& alloc) {
+  Funnel<Alloc> funnel(alloc);
+  std::atomic<bool> start = false;
+  std::vector<std::thread> threads;
+  int64_t per_producer = event_count / producers;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p] {
+      while (!start.load(std::memory_order_acquire)) {
+      }
+      for (int64_t i = 0; i < per_producer; ++i) {
+        funnel.push(p * per_producer + i);
+      }
+    });
+  }
+
+  using std::chrono::steady_clock;
+  auto begin = steady_clock::now();
+  start.store(true, std::memory_order_release);
+  List<int64_t, Alloc> batch(alloc);
+  uint64_t checksum = 0;
+  for (int64_t seen = 0; seen < per_producer * producers;) {
+    seen += static_cast<int64_t>(funnel.drain_into(batch));
+    for (int64_t value : batch) {
+      checksum += static_cast<uint64_t>(value);
+    }
+    batch.clear();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed = steady_clock::now() - begin;
+  return {elapsed.count(), checksum};
+}
+
+// Runs `body` with a StackAllocator on a fresh concurrent storage.
+template <typename Body>
+auto with_storage(Body body) {
+  using Storage = StackStorage<arena_size, Concurrent<>>;
+  std::unique_ptr<Storage> storage(new Storage);
+  return body(StackAllocator<int64_t, arena_size, Concurrent<>>(*storage));
+}
+
+template <typename WithAlloc>
+void report(const std::string& name, int producers, WithAlloc with_alloc,
+            uint64_t& checksum) {
+  double best = 0;
+  for (int run = 0; run < 3; ++run) {
+    Result result = with_alloc(producers);
+    if (run == 0 || result.seconds < best) {
+      best = result.seconds;
+    }
+    checksum += result.checksum;
+  }
+  std::cerr << "  " << name << ": " << best * 1e3 << " ms, "
+            << static_cast<double>(event_count) / best << " events/s"
+            << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  int max_producers =
+      std::max(2, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  uint64_t checksum = 0;
+  for (int producers = 1; producers <= max_producers; producers *= 2) {
+    std::cerr << producers << " producers, 1 consumer:" << std::endl;
+    report("mutex + List, std::allocator", producers,
+           [](int n) { return run<LockedList>(n, std::allocator<int64_t>()); },
+           checksum);
+    report("mutex + List, StackAllocator", producers,
+           [](int n) {
+             return with_storage(
+                 [n](const auto& alloc) { return run<LockedList>(n, alloc); });
+           },
+           checksum);
+    report("MpscQueue, std::allocator", producers,
+           [](int n) { return run<Queue>(n, std::allocator<int64_t>()); },
+           checksum);
+    report("MpscQueue, StackAllocator", producers,
+           [](int n) {
+             return with_storage(
+                 [n](const auto& alloc) { return run<Queue>(n, alloc); });
+           },
+           checksum);
+  }
+  std::cout << checksum << std::endl;
+}
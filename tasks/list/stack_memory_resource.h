@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "stackallocator.h"
+
+// Lets std::pmr containers allocate from a StackStorage it does not own, so
+// that containers of any element type can share one arena without naming it
+// in their types. Resources are equal when they use the same storage.
+template <size_t N, typename Policy = DefaultStoragePolicy>
+class StackMemoryResource : public std::pmr::memory_resource {
+ public:
+  explicit StackMemoryResource(StackStorage<N, Policy>& storage) noexcept
+      : storage_(&storage) {
+  }
+
+  StackStorage<N, Policy>& storage() const noexcept {
+    return *storage_;
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return storage_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    storage_->deallocate(ptr, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    const auto* resource = dynamic_cast<const StackMemoryResource*>(&other);
+    return resource != nullptr && resource->storage_ == storage_;
+  }
+
+  StackStorage<N, Policy>* storage_;
+};
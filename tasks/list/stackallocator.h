@@ -1,3 +1,2515 @@
-#define NO_TEST  // remove when solution is ready
+#pragma once
 
-// your code here
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+
+// Policies for StackStorage. A policy that defines `slab_bytes` makes the
+// storage safe to share between threads; one that defines
+// `first_block_bytes` lets it grow past N bytes; one that defines
+// `huge_pages` maps its N bytes from the OS; one that defines
+// `heap_fallback` takes what does not fit in N bytes from the heap; one that
+// defines `collect_stats` makes it count what it does.
+
+// A fixed arena used by one thread at a time.
+struct SingleThreaded {};
+
+// Used by any number of threads at once. Each thread claims `SlabBytes` of
+// the arena at a time with one atomic update, then serves its small blocks
+// from that slab and from free lists of its own, so the common path touches
+// no shared cache line. A block freed by one thread is reused by that thread.
+// A thread keeps slabs and free lists for the few storages of a type it used
+// last; when it takes up one more, those of the least recently used are
+// dropped, and what was left in them stays unused.
+template <size_t SlabBytes = 64 * 1024>
+struct Concurrent {
+  static constexpr size_t slab_bytes = SlabBytes;
+};
+
+// Used by one thread at a time, and never full. The N bytes inside the
+// storage come first; after them come heap blocks of `FirstBlockBytes`,
+// twice that, and so on, so a storage holds about as much memory as its
+// peak use however large or small N is. Allocation is still a bump of a
+// pointer within the current block. The tail of a block too short for the
+// next allocation goes unused.
+//
+// Blocks go back to operator delete when the storage is destroyed or
+// rewound. With SpareBytes, each thread instead keeps the largest such block
+// of at most SpareBytes for the next storage of the type to grow into, so
+// short-lived storages created one after another do not fault their pages in
+// anew; StackStorage::release_spare() frees it.
+template <size_t FirstBlockBytes = 64 * 1024, size_t SpareBytes = 0>
+struct Growable {
+  static constexpr size_t first_block_bytes = FirstBlockBytes;
+  static constexpr size_t spare_bytes = SpareBytes;
+};
+
+// Used by one thread at a time. The N bytes are not inside the storage but
+// reserved as address space with mmap, and committed 2 MiB at a time as the
+// bump pointer reaches them, so a large arena costs the memory it has used
+// and nothing on the stack. With HugePages the arena is backed by 2 MiB
+// pages, which spares the TLB when nodes are spread over hundreds of
+// megabytes: from the hugetlb pool if it has enough free pages, otherwise
+// transparent huge pages where the kernel allows them.
+template <bool HugePages = false>
+struct Mapped {
+  static constexpr bool huge_pages = HugePages;
+};
+
+// Used by one thread at a time, and never full. A block that does not fit
+// in the N bytes comes from operator new, and goes back to operator delete,
+// so a small storage can hold the first few nodes of a container and leave
+// the rest to the heap. See InlineAllocator.
+struct HeapFallback {
+  static constexpr bool heap_fallback = true;
+};
+
+// `Base` with StackStorageStats kept up to date, for single-threaded
+// storages; see StackStorage::stats().
+template <typename Base = SingleThreaded>
+struct WithStats : Base {
+  static constexpr bool collect_stats = true;
+};
+
+// Building with STACK_STORAGE_STATS makes storages count by default.
+#ifdef STACK_STORAGE_STATS
+using DefaultStoragePolicy = WithStats<>;
+#else
+using DefaultStoragePolicy = SingleThreaded;
+#endif
+
+// What a StackStorage with stats has done so far. Sizes are the ones asked
+// for; `padding` is what the storage spends beyond them: the rounding of
+// small blocks in use up to their size class, and the bytes the bump
+// pointer has skipped to align blocks.
+struct StackStorageStats {
+  static constexpr size_t histogram_buckets = 16;
+
+  size_t in_use = 0;
+  size_t high_water = 0;
+  size_t padding = 0;
+  size_t allocations = 0;
+  size_t deallocations = 0;
+  // Bucket i counts allocations of [2^(i-1), 2^i) bytes; the last bucket
+  // also counts every larger one.
+  size_t histogram[histogram_buckets] = {};
+};
+
+// An arena of N bytes handed out from the front, like a stack.
+//
+// Small blocks are rounded up to a multiple of `granule` bytes, and a
+// deallocated small block goes on a free list for its size, to be handed out
+// again by the next allocation of that size. A container that keeps erasing
+// and inserting nodes therefore runs in the memory its peak size needs rather
+// than running through the arena. Larger blocks are given back only when they
+// are the most recent allocation.
+template <size_t N, typename Policy = DefaultStoragePolicy>
+class StackStorage {
+  static constexpr bool is_concurrent = requires { Policy::slab_bytes; };
+  static constexpr bool is_growable = requires { Policy::first_block_bytes; };
+  static constexpr bool has_stats = requires { Policy::collect_stats; };
+  static constexpr bool is_mapped = requires { Policy::huge_pages; };
+  static constexpr bool has_fallback = requires { Policy::heap_fallback; };
+  static_assert(!(is_concurrent && is_growable),
+                "A growable StackStorage is single-threaded");
+  static_assert(!(is_mapped && (is_concurrent || is_growable)),
+                "A mapped StackStorage is single-threaded and fixed");
+  static_assert(!(has_fallback && (is_concurrent || is_growable || is_mapped)),
+                "A StackStorage with a heap fallback is single-threaded");
+  static_assert(!(is_concurrent && has_stats),
+                "Stats are kept for single-threaded storages only");
+  static_assert(N > 0, "StackStorage needs at least one byte inline");
+
+  static constexpr bool keeps_spare =
+      requires { requires Policy::spare_bytes > 0; };
+
+ public:
+  static constexpr size_t granule = alignof(std::max_align_t);
+  static constexpr size_t size_classes = 16;
+  static constexpr size_t max_small = granule * size_classes;
+
+  StackStorage() {
+    if constexpr (is_mapped) {
+      map_arena();
+    }
+  }
+
+  StackStorage(const StackStorage&) = delete;
+  StackStorage& operator=(const StackStorage&) = delete;
+
+  ~StackStorage() {
+    if constexpr (is_growable) {
+      release_blocks(nullptr);
+    }
+    if constexpr (is_mapped) {
+      munmap(block_, mapping_.reserved);
+    }
+  }
+
+  void* allocate(size_t bytes, size_t alignment) {
+    if (!is_small(bytes, alignment)) {
+      void* block = bump(bytes, alignment);
+      count_allocation(bytes, 0);
+      return block;
+    }
+    if constexpr (is_concurrent) {
+      ThreadCache& cache = thread_cache();
+      void* block = pop_free(cache, bytes);
+      return block != nullptr ? block : carve(cache, rounded(bytes));
+    } else {
+      void* block = pop_free(free_, bytes);
+      if (block == nullptr) {
+        block = bump(rounded(bytes), granule);
+      }
+      count_allocation(bytes, rounded(bytes) - bytes);
+      return block;
+    }
+  }
+
+  void deallocate(void* ptr, size_t bytes, size_t alignment) noexcept {
+    count_deallocation(bytes, is_small(bytes, alignment)
+                                  ? rounded(bytes) - bytes
+                                  : 0);
+    if constexpr (has_fallback) {
+      if (!owns(ptr)) {
+        heap_deallocate(ptr, is_small(bytes, alignment) ? granule : alignment);
+        return;
+      }
+    }
+    if (is_small(bytes, alignment)) {
+      if constexpr (is_concurrent) {
+        push_free(thread_cache(), ptr, bytes);
+      } else {
+        push_free(free_, ptr, bytes);
+      }
+      return;
+    }
+    char* block = static_cast<char*>(ptr);
+    if constexpr (is_concurrent) {
+      auto begin = static_cast<size_t>(block - buffer_);
+      size_t end = begin + bytes;
+      top_.compare_exchange_strong(end, begin, std::memory_order_relaxed);
+    } else if (block + bytes == block_ + top_) {
+      top_ = static_cast<size_t>(block - block_);
+    }
+  }
+
+  // A point to rewind the storage to; see checkpoint().
+  class Checkpoint;
+
+  // Marks the current state of the storage. Blocks freed before the mark are
+  // set aside until the storage is rewound to it, and blocks allocated
+  // before it and freed after it are only reused until then.
+  Checkpoint checkpoint() noexcept
+    requires(!is_concurrent && !has_fallback)
+  {
+    return Checkpoint(std::exchange(free_, FreeLists()), top_, chain_, stats_);
+  }
+
+  // Releases every block allocated since `mark` at once, without touching
+  // the blocks themselves, and invalidates marks taken after it. Containers
+  // using those blocks must not be used again, not even destroyed; abandon
+  // them, which is fine when their elements need no destructor to run.
+  void rewind(const Checkpoint& mark) noexcept
+    requires(!is_concurrent && !has_fallback)
+  {
+    if constexpr (is_growable) {
+      release_blocks(mark.chain_.last);
+      chain_ = mark.chain_;
+      enter_block(chain_.last);
+    }
+    free_ = mark.free_;
+    top_ = mark.top_;
+    if constexpr (has_stats) {
+      stats_.in_use = mark.stats_.in_use;
+      stats_.padding = mark.stats_.padding;
+    }
+  }
+
+  const StackStorageStats& stats() const noexcept
+    requires has_stats
+  {
+    return stats_;
+  }
+
+  // The size of the block this thread keeps for storages of this type, or 0
+  // if it keeps none.
+  static size_t spare_size() noexcept
+    requires is_growable
+  {
+    if constexpr (keeps_spare) {
+      BlockHeader* block = spare_block().block;
+      return block != nullptr ? block->size : 0;
+    } else {
+      return 0;
+    }
+  }
+
+  // Frees the block this thread keeps for storages of this type, if any.
+  static void release_spare() noexcept
+    requires is_growable
+  {
+    if constexpr (keeps_spare) {
+      ::operator delete(std::exchange(spare_block().block, nullptr));
+    }
+  }
+
+  // Bytes taken from the arena so far, including blocks on the free lists
+  // and the unused parts of threads' slabs.
+  size_t used() const noexcept {
+    if constexpr (is_concurrent) {
+      return top_.load(std::memory_order_relaxed);
+    } else if constexpr (is_growable) {
+      return chain_.retired + top_;
+    } else {
+      return top_;
+    }
+  }
+
+ private:
+  // A free block starts with the address of the next one in its list.
+  struct FreeBlock;
+
+  struct FreeLists {
+    FreeBlock* heads[size_classes] = {};
+  };
+
+  struct NoFreeLists {};
+
+  // Starts each heap block of a growable storage; the block's bytes follow.
+  struct alignas(std::max_align_t) BlockHeader {
+    BlockHeader* prev;
+    size_t size;
+  };
+
+  struct SpareBlock {
+    ~SpareBlock() {
+      ::operator delete(block);
+    }
+
+    BlockHeader* block = nullptr;
+  };
+
+  // The heap blocks of a growable storage, newest first, the size of the
+  // next one, and the bytes handed out from the blocks before the current.
+  struct Chain {
+    BlockHeader* last = nullptr;
+    size_t next_size = Policy::first_block_bytes;
+    size_t retired = 0;
+  };
+
+  struct NoChain {};
+
+  using ChainState = std::conditional_t<is_growable, Chain, NoChain>;
+
+  struct NoStats {};
+
+  // The address space of a mapped storage, and how much of it is usable.
+  struct Mapping {
+    size_t reserved = 0;
+    size_t committed = 0;
+  };
+
+  struct NoMapping {};
+
+  static constexpr size_t commit_step = size_t{2} << 20;
+
+  // A mapped storage keeps its bytes outside, and buffer_ is a placeholder.
+  static constexpr size_t inline_bytes = is_mapped ? 1 : N;
+
+  using StatsState = std::conditional_t<has_stats, StackStorageStats, NoStats>;
+
+  // A thread's share of a concurrent storage: its free lists and what is
+  // left of its slab. `owner` is the id of the storage they belong to.
+  struct ThreadCache : FreeLists {
+    uint64_t owner = 0;
+    char* cur = nullptr;
+    char* end = nullptr;
+  };
+
+  static bool is_small(size_t bytes, size_t alignment) {
+    return bytes <= max_small && alignment <= granule;
+  }
+
+  static size_t size_class(size_t bytes) {
+    return (std::max<size_t>(bytes, 1) - 1) / granule;
+  }
+
+  static size_t rounded(size_t bytes) {
+    return (size_class(bytes) + 1) * granule;
+  }
+
+  // Links are copied as bytes. A block on a free list may be bumped over
+  // after a rewind without its link ever being read, and typed stores to it
+  // could then be moved past the stores of the block's next user.
+  static void* pop_free(FreeLists& lists, size_t bytes) {
+    FreeBlock*& head = lists.heads[size_class(bytes)];
+    FreeBlock* block = head;
+    if (block != nullptr) {
+      std::memcpy(&head, block, sizeof(head));
+    }
+    return block;
+  }
+
+  static void push_free(FreeLists& lists, void* ptr, size_t bytes) {
+    FreeBlock*& head = lists.heads[size_class(bytes)];
+    std::memcpy(ptr, &head, sizeof(head));
+    head = static_cast<FreeBlock*>(ptr);
+  }
+
+  // Ids tell concurrent storages apart in the thread caches even when a new
+  // storage takes the address of a destroyed one. Other storages have none,
+  // so that creating one touches no shared counter.
+  static uint64_t next_id() {
+    static std::atomic<uint64_t> last_id = 0;
+    return last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  struct NoId {};
+
+  static auto make_id() {
+    if constexpr (is_concurrent) {
+      return next_id();
+    } else {
+      return NoId();
+    }
+  }
+
+  // How many storages of this type a thread keeps caches for.
+  static constexpr size_t thread_caches = 8;
+
+  // The thread's caches are kept most recently used first, so that a thread
+  // that sticks to one storage finds its cache at once, and one that moves
+  // between a few storages keeps the slab and free lists of each.
+  ThreadCache& thread_cache() {
+    static thread_local ThreadCache caches[thread_caches];
+    if (caches[0].owner == id_) {
+      return caches[0];
+    }
+    size_t index = 1;
+    while (index + 1 < thread_caches && caches[index].owner != id_) {
+      ++index;
+    }
+    ThreadCache cache = caches[index];
+    if (cache.owner != id_) {
+      cache = ThreadCache();
+      cache.owner = id_;
+    }
+    std::copy_backward(caches, caches + index, caches + index + 1);
+    caches[0] = cache;
+    return caches[0];
+  }
+
+  // Takes `bytes` from the thread's slab, first claiming a new slab if the
+  // current one is too short. The last slab of the arena may be shorter.
+  void* carve(ThreadCache& cache, size_t bytes) {
+    if (static_cast<size_t>(cache.end - cache.cur) < bytes) {
+      size_t top = top_.load(std::memory_order_relaxed);
+      size_t begin = 0;
+      size_t slab = 0;
+      do {
+        begin = std::min((top + granule - 1) / granule * granule, N);
+        slab = std::min(Policy::slab_bytes, N - begin);
+        if (slab < bytes) {
+          throw std::bad_alloc();
+        }
+      } while (!top_.compare_exchange_weak(top, begin + slab,
+                                           std::memory_order_relaxed));
+      cache.cur = buffer_ + begin;
+      cache.end = cache.cur + slab;
+    }
+    void* block = cache.cur;
+    cache.cur += bytes;
+    return block;
+  }
+
+  void* bump(size_t bytes, size_t alignment) {
+    if constexpr (is_concurrent) {
+      size_t top = top_.load(std::memory_order_relaxed);
+      void* ptr = nullptr;
+      do {
+        ptr = aligned_at(top, bytes, alignment);
+        if (ptr == nullptr) {
+          throw std::bad_alloc();
+        }
+      } while (!top_.compare_exchange_weak(top, end_of(ptr, bytes),
+                                           std::memory_order_relaxed));
+      return ptr;
+    } else {
+      void* ptr = aligned_at(top_, bytes, alignment);
+      if (ptr == nullptr) {
+        if constexpr (is_growable) {
+          add_block(bytes + alignment);
+          ptr = aligned_at(top_, bytes, alignment);
+        } else if constexpr (has_fallback) {
+          return heap_allocate(bytes, alignment);
+        } else {
+          throw std::bad_alloc();
+        }
+      }
+      if constexpr (is_mapped) {
+        if (end_of(ptr, bytes) > mapping_.committed) {
+          commit(end_of(ptr, bytes));
+        }
+      }
+      if constexpr (has_stats) {
+        stats_.padding += static_cast<char*>(ptr) - (block_ + top_);
+      }
+      top_ = end_of(ptr, bytes);
+      return ptr;
+    }
+  }
+
+  bool owns(const void* ptr) const noexcept {
+    std::less<const void*> before;
+    return !before(ptr, buffer_) && before(ptr, buffer_ + N);
+  }
+
+  static void* heap_allocate(size_t bytes, size_t alignment) {
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      return ::operator new(bytes, std::align_val_t(alignment));
+    }
+    return ::operator new(bytes);
+  }
+
+  static void heap_deallocate(void* ptr, size_t alignment) noexcept {
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+      ::operator delete(ptr, std::align_val_t(alignment));
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  void count_allocation(size_t bytes, size_t padding) noexcept {
+    if constexpr (has_stats) {
+      stats_.in_use += bytes;
+      stats_.high_water = std::max(stats_.high_water, stats_.in_use);
+      stats_.padding += padding;
+      ++stats_.allocations;
+      ++stats_.histogram[std::min<size_t>(
+          std::bit_width(bytes), StackStorageStats::histogram_buckets - 1)];
+    }
+  }
+
+  void count_deallocation(size_t bytes, size_t padding) noexcept {
+    if constexpr (has_stats) {
+      stats_.in_use -= bytes;
+      stats_.padding -= padding;
+      ++stats_.deallocations;
+    }
+  }
+
+  // The first place at or after `top` in the current block that can hold
+  // the block asked for, or null if there is none.
+  void* aligned_at(size_t top, size_t bytes, size_t alignment) {
+    void* ptr = block_ + top;
+    size_t space = block_size_ - top;
+    return std::align(alignment, bytes, ptr, space);
+  }
+
+  size_t end_of(void* ptr, size_t bytes) const {
+    return static_cast<size_t>(static_cast<char*>(ptr) - block_) + bytes;
+  }
+
+  static size_t round_to_step(size_t bytes) {
+    return (bytes + commit_step - 1) / commit_step * commit_step;
+  }
+
+  // Reserves the arena of a mapped storage, starting on a 2 MiB boundary so
+  // that huge pages can back all of it.
+  void map_arena() {
+    size_t size = round_to_step(N);
+    void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if constexpr (Policy::huge_pages) {
+      // Without MAP_NORESERVE this fails now, rather than faulting later, if
+      // the pool is short of pages.
+      base = mmap(nullptr, size, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (base == MAP_FAILED) {
+      size_t padded = size + commit_step;
+      void* raw = mmap(nullptr, padded, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      char* first = static_cast<char*>(raw);
+      char* aligned = first + (round_to_step(reinterpret_cast<uintptr_t>(raw)) -
+                               reinterpret_cast<uintptr_t>(raw));
+      if (aligned != first) {
+        munmap(first, aligned - first);
+      }
+      munmap(aligned + size, first + padded - (aligned + size));
+      base = aligned;
+#ifdef MADV_HUGEPAGE
+      if constexpr (Policy::huge_pages) {
+        madvise(base, size, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    block_ = static_cast<char*>(base);
+    mapping_.reserved = size;
+  }
+
+  // Makes a mapped arena usable up to at least `end`.
+  void commit(size_t end) {
+    size_t target = std::min(round_to_step(end), mapping_.reserved);
+    char* from = block_ + mapping_.committed;
+    size_t length = target - mapping_.committed;
+    if (mprotect(from, length, PROT_READ | PROT_WRITE) != 0) {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_POPULATE_WRITE
+    // Faulting a step in with one call is cheaper than a fault per page; if
+    // the kernel cannot, the pages fault in as they are touched.
+    madvise(from, length, MADV_POPULATE_WRITE);
+#endif
+    mapping_.committed = target;
+  }
+
+  static SpareBlock& spare_block() {
+    static thread_local SpareBlock spare;
+    return spare;
+  }
+
+  // Keeps a block given back as the thread's spare if it is no larger than
+  // the policy allows and larger than the spare the thread already has, and
+  // frees it otherwise.
+  static void keep_spare(BlockHeader* block) {
+    if constexpr (keeps_spare) {
+      SpareBlock& spare = spare_block();
+      if (block->size <= Policy::spare_bytes &&
+          (spare.block == nullptr || spare.block->size < block->size)) {
+        std::swap(spare.block, block);
+      }
+    }
+    ::operator delete(block);
+  }
+
+  // Gives back the heap blocks newer than `last`, keeping the largest one the
+  // policy allows as the thread's spare.
+  void release_blocks(BlockHeader* last) noexcept {
+    while (chain_.last != last) {
+      BlockHeader* block = chain_.last;
+      chain_.last = block->prev;
+      keep_spare(block);
+    }
+  }
+
+  // Makes `header`'s block, or the inline buffer if it is null, the one
+  // `top_` is an offset into.
+  void enter_block(BlockHeader* header) noexcept {
+    if (header == nullptr) {
+      block_ = buffer_;
+      block_size_ = N;
+      return;
+    }
+    block_ = reinterpret_cast<char*>(header + 1);
+    block_size_ = header->size - sizeof(BlockHeader);
+  }
+
+  // Moves a growable storage on to a new heap block of at least `bytes`,
+  // the thread's spare one if it keeps one and it is large enough.
+  void add_block(size_t bytes) {
+    size_t size = std::max(chain_.next_size, bytes + sizeof(BlockHeader));
+    BlockHeader* header = nullptr;
+    if constexpr (keeps_spare) {
+      SpareBlock& spare = spare_block();
+      if (spare.block != nullptr && spare.block->size >= size) {
+        header = std::exchange(spare.block, nullptr);
+        size = header->size;
+      }
+    }
+    if (header == nullptr) {
+      header = static_cast<BlockHeader*>(::operator new(size));
+      header->size = size;
+    }
+    header->prev = chain_.last;
+    chain_.last = header;
+    chain_.next_size = 2 * size;
+    chain_.retired += top_;
+    enter_block(header);
+    top_ = 0;
+  }
+
+  [[no_unique_address]] std::conditional_t<is_concurrent, NoFreeLists,
+                                           FreeLists> free_;
+  std::conditional_t<is_concurrent, std::atomic<size_t>, size_t> top_ = 0;
+  // The block `top_` is an offset into: buffer_, in a growable storage its
+  // newest heap block, or in a mapped storage its mapping.
+  char* block_ = buffer_;
+  size_t block_size_ = N;
+  [[no_unique_address]] ChainState chain_;
+  [[no_unique_address]] StatsState stats_;
+  [[no_unique_address]] std::conditional_t<is_mapped, Mapping, NoMapping>
+      mapping_;
+  [[no_unique_address]] const std::conditional_t<is_concurrent, uint64_t,
+                                                 NoId> id_ = make_id();
+  alignas(std::max_align_t) char buffer_[inline_bytes];
+};
+
+template <size_t N, typename Policy>
+class StackStorage<N, Policy>::Checkpoint {
+ private:
+  friend class StackStorage;
+
+  Checkpoint(const FreeLists& free, size_t top, const ChainState& chain,
+             const StatsState& stats)
+      : free_(free),
+        top_(top),
+        chain_(chain),
+        stats_(stats) {
+  }
+
+  FreeLists free_;
+  size_t top_;
+  [[no_unique_address]] ChainState chain_;
+  [[no_unique_address]] StatsState stats_;
+};
+
+// Rewinds a storage, when it goes out of scope, to where it was when the
+// scope was entered. Scratch containers built on the storage inside the
+// scope are then abandoned rather than destroyed.
+template <size_t N, typename Policy>
+class StackScope {
+ public:
+  explicit StackScope(StackStorage<N, Policy>& storage) noexcept
+      : storage_(storage),
+        mark_(storage.checkpoint()) {
+  }
+
+  StackScope(const StackScope&) = delete;
+  StackScope& operator=(const StackScope&) = delete;
+
+  ~StackScope() {
+    storage_.rewind(mark_);
+  }
+
+ private:
+  StackStorage<N, Policy>& storage_;
+  typename StackStorage<N, Policy>::Checkpoint mark_;
+};
+
+// Allocates from a StackStorage it does not own; copies, including rebound
+// ones, share the storage and compare equal.
+template <typename T, size_t N, typename Policy = DefaultStoragePolicy>
+class StackAllocator {
+ public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = StackAllocator<U, N, Policy>;
+  };
+
+  explicit StackAllocator(StackStorage<N, Policy>& storage) noexcept
+      : storage_(&storage) {
+  }
+
+  template <typename U>
+  StackAllocator(const StackAllocator<U, N, Policy>& other) noexcept
+      : storage_(other.storage_) {
+  }
+
+  T* allocate(size_t count) {
+    if (count > std::numeric_limits<size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T*>(
+        storage_->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t count) noexcept {
+    storage_->deallocate(ptr, count * sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  bool operator==(const StackAllocator<U, N, Policy>& other) const noexcept {
+    return storage_ == other.storage_;
+  }
+
+ private:
+  template <typename U, size_t M, typename P>
+  friend class StackAllocator;
+
+  StackStorage<N, Policy>* storage_;
+};
+
+// Allocates from a StackStorage<N, HeapFallback>, normally the one inside
+// the InlineContainer it belongs to, so that the first N bytes a container
+// asks for come from the container itself and the rest from the heap. Copies
+// share the storage and compare equal. None of them propagates: the storage
+// stays with its container, and a copy of a container gets an allocator with
+// no storage, which allocates from the heap, unless it is an InlineContainer
+// with storage of its own.
+template <typename T, size_t N>
+class InlineAllocator {
+ public:
+  using value_type = T;
+  using storage_type = StackStorage<N, HeapFallback>;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::false_type;
+  using propagate_on_container_swap = std::false_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U>
+  struct rebind {
+    using other = InlineAllocator<U, N>;
+  };
+
+  InlineAllocator() noexcept = default;
+
+  explicit InlineAllocator(storage_type& storage) noexcept
+      : storage_(&storage) {
+  }
+
+  template <typename U>
+  InlineAllocator(const InlineAllocator<U, N>& other) noexcept
+      : storage_(other.storage_) {
+  }
+
+  InlineAllocator select_on_container_copy_construction() const noexcept {
+    return InlineAllocator();
+  }
+
+  T* allocate(size_t count) {
+    if (count > std::numeric_limits<size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    if (storage_ == nullptr) {
+      return std::allocator<T>().allocate(count);
+    }
+    return static_cast<T*>(
+        storage_->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t count) noexcept {
+    if (storage_ == nullptr) {
+      std::allocator<T>().deallocate(ptr, count);
+      return;
+    }
+    storage_->deallocate(ptr, count * sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  bool operator==(const InlineAllocator<U, N>& other) const noexcept {
+    return storage_ == other.storage_;
+  }
+
+ private:
+  template <typename U, size_t M>
+  friend class InlineAllocator;
+
+  storage_type* storage_ = nullptr;
+};
+
+// Holds the storage of an InlineContainer; a base class, so that the
+// storage exists before the container that allocates from it.
+template <typename Storage>
+struct InlineStorageBase {
+  Storage inline_storage;
+};
+
+// `Container`, whose allocator is an InlineAllocator<T, N>, with the
+// StackStorage its allocator serves the first N bytes from inside it. A List
+// of int takes 32 bytes a node, so N = 256 keeps eight nodes off the heap.
+// Copies and moves build their elements in their own storage; moving one
+// therefore moves its elements one by one rather than handing nodes over.
+// Moving or swapping one into a plain `Container` would leave that
+// container's nodes in this one, so use these operations on the
+// InlineContainer itself.
+template <typename Container>
+class InlineContainer
+    : private InlineStorageBase<
+          typename Container::allocator_type::storage_type>,
+      public Container {
+  using Alloc = typename Container::allocator_type;
+
+ public:
+  InlineContainer()
+      : Container(Alloc(this->inline_storage)) {
+  }
+
+  // Forwards to the constructor of `Container` that takes the same
+  // arguments followed by an allocator.
+  template <typename... Args>
+  explicit InlineContainer(Args&&... args)
+    requires(!(std::is_same_v<std::remove_cvref_t<Args>, InlineContainer> ||
+               ...))
+      : Container(std::forward<Args>(args)..., Alloc(this->inline_storage)) {
+  }
+
+  InlineContainer(const InlineContainer& other)
+      : Container(other, Alloc(this->inline_storage)) {
+  }
+
+  InlineContainer(InlineContainer&& other)
+      : Container(std::move(other), Alloc(this->inline_storage)) {
+  }
+
+  // Assignments clear this container first, so that the new elements can
+  // use the storage the old ones leave. If one throws, the container is
+  // left empty.
+  InlineContainer& operator=(const InlineContainer& other) {
+    if (this != &other) {
+      Container::clear();
+      Container::operator=(other);
+    }
+    return *this;
+  }
+
+  InlineContainer& operator=(InlineContainer&& other) {
+    if (this != &other) {
+      Container::clear();
+      Container::operator=(std::move(other));
+    }
+    return *this;
+  }
+
+  void swap(InlineContainer& other) {
+    InlineContainer tmp(std::move(other));
+    other = std::move(*this);
+    *this = std::move(tmp);
+  }
+};
+
+template <typename T, typename Alloc = std::allocator<T>>
+class MpscQueue;
+
+// Doubly linked list with a sentinel node kept inside the List object, so the
+// list is circular and neither end needs a special case. Nodes come from
+// `Alloc` rebound to the node type.
+template <typename T, typename Alloc = std::allocator<T>>
+class List {
+ private:
+  template <bool IsConst>
+  class BaseIterator;
+
+  class NodeHandle;
+
+  friend class MpscQueue<T, Alloc>;
+
+ public:
+  using value_type = T;
+  using allocator_type = Alloc;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = BaseIterator<false>;
+  using const_iterator = BaseIterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using node_type = NodeHandle;
+
+  List()
+      : List(Alloc()) {
+  }
+
+  explicit List(const Alloc& alloc)
+      : alloc_(alloc) {
+  }
+
+  explicit List(size_t count, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    try {
+      for (size_t i = 0; i < count; ++i) {
+        link_before(&fake_, create_node());
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  List(size_t count, const T& value, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    try {
+      for (size_t i = 0; i < count; ++i) {
+        link_before(&fake_, create_node(value));
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  List(const List& other)
+      : List(other, AllocTraits::select_on_container_copy_construction(
+                        other.get_allocator())) {
+  }
+
+  List(const List& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    try {
+      for (const T& value : other) {
+        link_before(&fake_, create_node(value));
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  List(List&& other) noexcept
+      : alloc_(std::move(other.alloc_)) {
+    take_nodes(other);
+  }
+
+  // Takes the nodes of `other` if `alloc` compares equal to its allocator,
+  // and otherwise moves its elements to new nodes one by one.
+  List(List&& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    if (alloc_ == other.alloc_) {
+      take_nodes(other);
+      return;
+    }
+    try {
+      for (T& value : other) {
+        link_before(&fake_, create_node(std::move(value)));
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  ~List() {
+    clear();
+  }
+
+  List& operator=(const List& other) {
+    if (this != &other) {
+      List copy(
+          other,
+          AllocTraits::propagate_on_container_copy_assignment::value
+              ? other.alloc_
+              : alloc_);
+      swap_all(copy);
+    }
+    return *this;
+  }
+
+  // An allocator that does not propagate keeps its list, which then moves
+  // the elements over unless the allocators compare equal.
+  List& operator=(List&& other) noexcept(move_steals_nodes) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (move_steals_nodes) {
+      List moved(std::move(other));
+      swap_all(moved);
+    } else {
+      List moved(std::move(other), get_allocator());
+      swap_all(moved);
+    }
+    return *this;
+  }
+
+  // Allocators are swapped only if they propagate on swap; if they do not,
+  // they must compare equal.
+  void swap(List& other) noexcept {
+    if constexpr (AllocTraits::propagate_on_container_swap::value) {
+      std::swap(alloc_, other.alloc_);
+    }
+    swap_nodes(other);
+  }
+
+  allocator_type get_allocator() const {
+    return alloc_;
+  }
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  T& front() {
+    return *begin();
+  }
+
+  const T& front() const {
+    return *begin();
+  }
+
+  T& back() {
+    return *rbegin();
+  }
+
+  const T& back() const {
+    return *rbegin();
+  }
+
+  iterator begin() noexcept {
+    return iterator(fake_.next);
+  }
+
+  const_iterator begin() const noexcept {
+    return cbegin();
+  }
+
+  const_iterator cbegin() const noexcept {
+    return const_iterator(fake_.next);
+  }
+
+  iterator end() noexcept {
+    return iterator(&fake_);
+  }
+
+  const_iterator end() const noexcept {
+    return cend();
+  }
+
+  const_iterator cend() const noexcept {
+    return const_iterator(const_cast<BaseNode*>(&fake_));
+  }
+
+  reverse_iterator rbegin() noexcept {
+    return reverse_iterator(end());
+  }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return crbegin();
+  }
+
+  const_reverse_iterator crbegin() const noexcept {
+    return const_reverse_iterator(cend());
+  }
+
+  reverse_iterator rend() noexcept {
+    return reverse_iterator(begin());
+  }
+
+  const_reverse_iterator rend() const noexcept {
+    return crend();
+  }
+
+  const_reverse_iterator crend() const noexcept {
+    return const_reverse_iterator(cbegin());
+  }
+
+  void push_back(const T& value) {
+    emplace_back(value);
+  }
+
+  void push_back(T&& value) {
+    emplace_back(std::move(value));
+  }
+
+  void push_front(const T& value) {
+    emplace_front(value);
+  }
+
+  void push_front(T&& value) {
+    emplace_front(std::move(value));
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    return *emplace(cend(), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  T& emplace_front(Args&&... args) {
+    return *emplace(cbegin(), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    Node* node = create_node(std::forward<Args>(args)...);
+    link_before(pos.node_, node);
+    return iterator(node);
+  }
+
+  void pop_back() {
+    destroy_node(unlink(fake_.prev));
+  }
+
+  void pop_front() {
+    destroy_node(unlink(fake_.next));
+  }
+
+  iterator insert(const_iterator pos, const T& value) {
+    return emplace(pos, value);
+  }
+
+  iterator insert(const_iterator pos, T&& value) {
+    return emplace(pos, std::move(value));
+  }
+
+  // Links the node held by `handle` before `pos` and leaves `handle` empty;
+  // an empty handle inserts nothing and gives back `pos`. The handle must
+  // come from a list whose allocator compares equal to this one's.
+  iterator insert(const_iterator pos, node_type&& handle) noexcept {
+    if (handle.empty()) {
+      return iterator(pos.node_);
+    }
+    Node* node = release(handle);
+    link_before(pos.node_, node);
+    return iterator(node);
+  }
+
+  // Unlinks the element at `pos` without destroying or deallocating it.
+  node_type extract(const_iterator pos) noexcept {
+    return node_type(unlink(pos.node_), alloc_);
+  }
+
+  iterator erase(const_iterator pos) {
+    BaseNode* next = pos.node_->next;
+    destroy_node(unlink(pos.node_));
+    return iterator(next);
+  }
+
+  void clear() noexcept {
+    while (size_ != 0) {
+      pop_back();
+    }
+  }
+
+  // The operations below only relink nodes: none of them allocates, and
+  // iterators and references to the elements stay valid, pointing into
+  // whichever list the element ends up in. Splicing and merging between
+  // lists need equal allocators.
+
+  void splice(const_iterator pos, List& other) noexcept {
+    if (other.size_ == 0) {
+      return;
+    }
+    transfer(pos.node_, other.fake_.next, &other.fake_);
+    size_ += std::exchange(other.size_, 0);
+  }
+
+  void splice(const_iterator pos, List&& other) noexcept {
+    splice(pos, other);
+  }
+
+  void splice(const_iterator pos, List& other, const_iterator it) noexcept {
+    BaseNode* next = it.node_->next;
+    if (pos.node_ == it.node_ || pos.node_ == next) {
+      return;
+    }
+    transfer(pos.node_, it.node_, next);
+    ++size_;
+    --other.size_;
+  }
+
+  void splice(const_iterator pos, List&& other, const_iterator it) noexcept {
+    splice(pos, other, it);
+  }
+
+  // Linear in the length of [first, last) when `other` is another list, to
+  // keep both sizes; constant otherwise.
+  void splice(const_iterator pos, List& other, const_iterator first,
+              const_iterator last) noexcept {
+    if (first == last) {
+      return;
+    }
+    if (this != &other) {
+      auto count = static_cast<size_t>(std::distance(first, last));
+      size_ += count;
+      other.size_ -= count;
+    }
+    transfer(pos.node_, first.node_, last.node_);
+  }
+
+  void splice(const_iterator pos, List&& other, const_iterator first,
+              const_iterator last) noexcept {
+    splice(pos, other, first, last);
+  }
+
+  // Merges the sorted `other` into this sorted list, moving runs of its
+  // nodes at a time. Among equal elements those of this list come first. If
+  // `comp` throws, both lists are left valid with every element in one of
+  // them.
+  template <typename Compare = std::less<>>
+  void merge(List& other, Compare comp = Compare()) {
+    if (this == &other) {
+      return;
+    }
+    BaseNode* it = fake_.next;
+    while (other.size_ != 0) {
+      BaseNode* first = other.fake_.next;
+      while (it != &fake_ && !comp(value(first), value(it))) {
+        it = it->next;
+      }
+      if (it == &fake_) {
+        splice(end(), other);
+        return;
+      }
+      BaseNode* last = first->next;
+      size_t count = 1;
+      while (last != &other.fake_ && comp(value(last), value(it))) {
+        last = last->next;
+        ++count;
+      }
+      transfer(it, first, last);
+      size_ += count;
+      other.size_ -= count;
+    }
+  }
+
+  template <typename Compare = std::less<>>
+  void merge(List&& other, Compare comp = Compare()) {
+    merge(other, comp);
+  }
+
+  // Stable bottom-up merge sort, see sort_chain(). If `comp` throws, the
+  // list keeps all its elements in some order.
+  template <typename Compare = std::less<>>
+  void sort(Compare comp = Compare()) {
+    if (size_ < 2) {
+      return;
+    }
+    BaseNode* head = fake_.next;
+    fake_.prev->next = nullptr;
+    auto less = [&comp](BaseNode* lhs, BaseNode* rhs) {
+      return comp(value(lhs), value(rhs));
+    };
+    try {
+      sort_chain(head, less);
+    } catch (...) {
+      relink_chain(head);
+      throw;
+    }
+    relink_chain(head);
+  }
+
+  // Moves the elements, in order, to newly allocated nodes placed at
+  // increasing addresses, so that however scattered the list has become a
+  // walk over it reads memory forwards. Invalidates all iterators and
+  // references. If an allocation or a copy throws, the list is unchanged.
+  void compact() {
+    if (size_ < 2) {
+      return;
+    }
+    BaseNode* head = nullptr;
+    BaseNode* last = nullptr;
+    std::less<BaseNode*> by_address;
+    bool ascending = true;
+    try {
+      for (size_t i = 0; i < size_; ++i) {
+        Node* node = NodeAllocTraits::allocate(alloc_, 1);
+        ::new (static_cast<void*>(node)) Node;
+        node->next = nullptr;
+        if (last == nullptr) {
+          head = node;
+        } else {
+          ascending = ascending && by_address(last, node);
+          last->next = node;
+        }
+        last = node;
+      }
+    } catch (...) {
+      deallocate_chain(head);
+      throw;
+    }
+    // Fresh memory usually comes in ascending order; reused blocks do not.
+    if (!ascending) {
+      sort_chain(head, by_address);
+    }
+    BaseNode* to = head;
+    if constexpr (std::is_nothrow_move_constructible_v<T>) {
+      // Nothing can throw any more, so each old node goes as soon as its
+      // value has moved, and the scattered nodes are visited once.
+      for (BaseNode* from = fake_.next; from != &fake_;) {
+        BaseNode* next = from->next;
+        NodeAllocTraits::construct(alloc_, static_cast<Node*>(to)->value(),
+                                   std::move(value(from)));
+        destroy_node(static_cast<Node*>(from));
+        from = next;
+        to = to->next;
+      }
+      relink_chain(head);
+      return;
+    }
+    try {
+      for (BaseNode* from = fake_.next; from != &fake_; from = from->next) {
+        NodeAllocTraits::construct(alloc_, static_cast<Node*>(to)->value(),
+                                   std::move_if_noexcept(value(from)));
+        to = to->next;
+      }
+    } catch (...) {
+      for (BaseNode* node = head; node != to; node = node->next) {
+        NodeAllocTraits::destroy(alloc_, static_cast<Node*>(node)->value());
+      }
+      deallocate_chain(head);
+      throw;
+    }
+    for (BaseNode* node = fake_.next; node != &fake_;) {
+      BaseNode* next = node->next;
+      destroy_node(static_cast<Node*>(node));
+      node = next;
+    }
+    relink_chain(head);
+  }
+
+  void reverse() noexcept {
+    BaseNode* node = &fake_;
+    do {
+      std::swap(node->prev, node->next);
+      node = node->prev;
+    } while (node != &fake_);
+  }
+
+  // Removes all but the first of each run of consecutive elements that
+  // `pred` finds equal, and returns how many were removed.
+  template <typename BinaryPredicate = std::equal_to<>>
+  size_t unique(BinaryPredicate pred = BinaryPredicate()) {
+    Removed removed(*this);
+    if (size_ < 2) {
+      return 0;
+    }
+    BaseNode* kept = fake_.next;
+    while (kept->next != &fake_) {
+      BaseNode* next = kept->next;
+      if (pred(value(kept), value(next))) {
+        removed.add(next);
+      } else {
+        kept = next;
+      }
+    }
+    return removed.count;
+  }
+
+  // Removed elements are destroyed only after the whole list has been
+  // examined, so `pred` may refer to an element of the list.
+  template <typename Predicate>
+  size_t remove_if(Predicate pred) {
+    Removed removed(*this);
+    BaseNode* node = fake_.next;
+    while (node != &fake_) {
+      BaseNode* next = node->next;
+      if (pred(value(node))) {
+        removed.add(node);
+      }
+      node = next;
+    }
+    return removed.count;
+  }
+
+  size_t remove(const T& target) {
+    return remove_if([&target](const T& element) {
+      return element == target;
+    });
+  }
+
+ private:
+  struct BaseNode {
+    BaseNode* prev;
+    BaseNode* next;
+  };
+
+  // The value lives in raw storage so that a node can be allocated and
+  // linked before, and independently of, constructing its value.
+  struct Node : BaseNode {
+    T* value() {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  using AllocTraits = std::allocator_traits<Alloc>;
+  using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+  using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+  static constexpr bool move_steals_nodes =
+      AllocTraits::propagate_on_container_move_assignment::value ||
+      AllocTraits::is_always_equal::value;
+
+  void swap_nodes(List& other) noexcept {
+    std::swap(fake_, other.fake_);
+    std::swap(size_, other.size_);
+    relink_ends();
+    other.relink_ends();
+  }
+
+  // Swaps allocators too, for the assignments: the list they build already
+  // has the allocator this one is to end up with.
+  void swap_all(List& other) noexcept {
+    std::swap(alloc_, other.alloc_);
+    swap_nodes(other);
+  }
+
+  template <typename... Args>
+  Node* create_node(Args&&... args) {
+    return create_node_with(alloc_, std::forward<Args>(args)...);
+  }
+
+  void destroy_node(Node* node) noexcept {
+    destroy_node_with(alloc_, node);
+  }
+
+  template <typename... Args>
+  static Node* create_node_with(NodeAlloc& alloc, Args&&... args) {
+    Node* node = NodeAllocTraits::allocate(alloc, 1);
+    ::new (static_cast<void*>(node)) Node;
+    try {
+      NodeAllocTraits::construct(alloc, node->value(),
+                                 std::forward<Args>(args)...);
+    } catch (...) {
+      NodeAllocTraits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  static void destroy_node_with(NodeAlloc& alloc, Node* node) noexcept {
+    NodeAllocTraits::destroy(alloc, node->value());
+    NodeAllocTraits::deallocate(alloc, node, 1);
+  }
+
+  // Takes the node out of a handle that holds one, leaving it empty.
+  static Node* release(node_type& handle) noexcept {
+    handle.alloc_.reset();
+    return std::exchange(handle.node_, nullptr);
+  }
+
+  void link_before(BaseNode* pos, BaseNode* node) noexcept {
+    node->prev = pos->prev;
+    node->next = pos;
+    pos->prev->next = node;
+    pos->prev = node;
+    ++size_;
+  }
+
+  Node* unlink(BaseNode* node) noexcept {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    --size_;
+    return static_cast<Node*>(node);
+  }
+
+  // Moves the nodes of `other`, which must not be this list, to this empty
+  // list, leaving `other` empty.
+  void take_nodes(List& other) noexcept {
+    fake_ = other.fake_;
+    size_ = other.size_;
+    relink_ends();
+    other.size_ = 0;
+    other.relink_ends();
+  }
+
+  static T& value(BaseNode* node) {
+    return *static_cast<Node*>(node)->value();
+  }
+
+  // Moves the nodes [first, last), which are not empty and do not contain
+  // `pos`, to just before `pos`. Sizes are left to the caller.
+  static void transfer(BaseNode* pos, BaseNode* first,
+                       BaseNode* last) noexcept {
+    BaseNode* tail = last->prev;
+    first->prev->next = last;
+    last->prev = first->prev;
+    first->prev = pos->prev;
+    tail->next = pos;
+    pos->prev->next = first;
+    pos->prev = tail;
+  }
+
+  // Appends the null-terminated chain `tail` to `head`, returning the head
+  // of the result.
+  static BaseNode* concat(BaseNode* head, BaseNode* tail) noexcept {
+    if (head == nullptr) {
+      return tail;
+    }
+    BaseNode* last = head;
+    while (last->next != nullptr) {
+      last = last->next;
+    }
+    last->next = tail;
+    return head;
+  }
+
+  // Stable bottom-up merge sort of the null-terminated chain `head` by
+  // `less`, which compares nodes. Runs of 2^i nodes wait in bins[i] as
+  // chains, so nothing is allocated and the recursion depth is nil. If
+  // `less` throws, `head` is left holding every node in some order.
+  template <typename Less>
+  static void sort_chain(BaseNode*& head, Less& less) {
+    BaseNode* rest = head;
+    BaseNode* bins[std::numeric_limits<size_t>::digits] = {};
+    BaseNode* run = nullptr;
+    try {
+      while (rest != nullptr) {
+        run = rest;
+        rest = rest->next;
+        run->next = nullptr;
+        size_t i = 0;
+        for (; bins[i] != nullptr; ++i) {
+          merge_chains(bins[i], run, less);
+          run = std::exchange(bins[i], nullptr);
+        }
+        bins[i] = std::exchange(run, nullptr);
+      }
+      for (BaseNode*& bin : bins) {
+        if (bin != nullptr) {
+          merge_chains(bin, run, less);
+          run = std::exchange(bin, nullptr);
+        }
+      }
+    } catch (...) {
+      run = concat(run, rest);
+      for (BaseNode* bin : bins) {
+        run = concat(bin, run);
+      }
+      head = run;
+      throw;
+    }
+    head = run;
+  }
+
+  // Merges the sorted null-terminated chain `from` into the sorted chain
+  // `into`, and leaves `from` null. Among equal nodes those of `into` come
+  // first. If `less` throws, `into` holds every node of both.
+  template <typename Less>
+  static void merge_chains(BaseNode*& into, BaseNode*& from, Less& less) {
+    BaseNode head;
+    BaseNode* tail = &head;
+    BaseNode* lhs = into;
+    BaseNode* rhs = from;
+    try {
+      while (lhs != nullptr && rhs != nullptr) {
+        if (less(rhs, lhs)) {
+          tail->next = rhs;
+          rhs = rhs->next;
+        } else {
+          tail->next = lhs;
+          lhs = lhs->next;
+        }
+        tail = tail->next;
+      }
+    } catch (...) {
+      tail->next = concat(lhs, rhs);
+      into = head.next;
+      from = nullptr;
+      throw;
+    }
+    tail->next = lhs != nullptr ? lhs : rhs;
+    into = head.next;
+    from = nullptr;
+  }
+
+  // Frees the null-terminated chain of nodes without values at `head`.
+  void deallocate_chain(BaseNode* head) noexcept {
+    while (head != nullptr) {
+      BaseNode* next = head->next;
+      NodeAllocTraits::deallocate(alloc_, static_cast<Node*>(head), 1);
+      head = next;
+    }
+  }
+
+  // Makes the null-terminated chain starting at `head`, which holds every
+  // node of the list, the list again.
+  void relink_chain(BaseNode* head) noexcept {
+    BaseNode* prev = &fake_;
+    for (BaseNode* node = head; node != nullptr; node = node->next) {
+      node->prev = prev;
+      prev->next = node;
+      prev = node;
+    }
+    prev->next = &fake_;
+    fake_.prev = prev;
+  }
+
+  // Nodes unlinked by unique() and remove_if(), destroyed when it goes out
+  // of scope, even if the predicate throws.
+  struct Removed {
+    explicit Removed(List& list)
+        : list(list) {
+    }
+
+    Removed(const Removed&) = delete;
+    Removed& operator=(const Removed&) = delete;
+
+    ~Removed() {
+      while (head != nullptr) {
+        BaseNode* next = head->next;
+        list.destroy_node(static_cast<Node*>(head));
+        head = next;
+      }
+    }
+
+    void add(BaseNode* node) noexcept {
+      list.unlink(node);
+      node->next = head;
+      head = node;
+      ++count;
+    }
+
+    List& list;
+    BaseNode* head = nullptr;
+    size_t count = 0;
+  };
+
+  // Points the end nodes back at this list's sentinel after the sentinel was
+  // copied from another list.
+  void relink_ends() noexcept {
+    if (size_ == 0) {
+      fake_.next = &fake_;
+      fake_.prev = &fake_;
+      return;
+    }
+    fake_.next->prev = &fake_;
+    fake_.prev->next = &fake_;
+  }
+
+  [[no_unique_address]] NodeAlloc alloc_;
+  BaseNode fake_ = {&fake_, &fake_};
+  size_t size_ = 0;
+};
+
+template <typename T, typename Alloc>
+template <bool IsConst>
+class List<T, Alloc>::BaseIterator {
+ public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = std::conditional_t<IsConst, const T*, T*>;
+  using reference = std::conditional_t<IsConst, const T&, T&>;
+
+  BaseIterator() = default;
+
+  operator BaseIterator<true>() const
+    requires(!IsConst)
+  {
+    return BaseIterator<true>(node_);
+  }
+
+  reference operator*() const {
+    return *static_cast<Node*>(node_)->value();
+  }
+
+  pointer operator->() const {
+    return static_cast<Node*>(node_)->value();
+  }
+
+  BaseIterator& operator++() {
+    node_ = node_->next;
+    return *this;
+  }
+
+  BaseIterator operator++(int) {
+    BaseIterator copy = *this;
+    ++*this;
+    return copy;
+  }
+
+  BaseIterator& operator--() {
+    node_ = node_->prev;
+    return *this;
+  }
+
+  BaseIterator operator--(int) {
+    BaseIterator copy = *this;
+    --*this;
+    return copy;
+  }
+
+  friend bool operator==(const BaseIterator& lhs, const BaseIterator& rhs) {
+    return lhs.node_ == rhs.node_;
+  }
+
+ private:
+  friend class List;
+  friend class BaseIterator<!IsConst>;
+
+  explicit BaseIterator(BaseNode* node)
+      : node_(node) {
+  }
+
+  BaseNode* node_ = nullptr;
+};
+
+// Owns a node unlinked by List::extract(), together with a copy of the
+// list's allocator, until insert() links it into a list again. A handle
+// that still holds its node destroys it.
+template <typename T, typename Alloc>
+class List<T, Alloc>::NodeHandle {
+ public:
+  using value_type = T;
+  using allocator_type = Alloc;
+
+  NodeHandle() = default;
+
+  NodeHandle(NodeHandle&& other) noexcept
+      : node_(std::exchange(other.node_, nullptr)),
+        alloc_(std::move(other.alloc_)) {
+    other.alloc_.reset();
+  }
+
+  NodeHandle& operator=(NodeHandle&& other) noexcept {
+    if (this != &other) {
+      reset();
+      node_ = std::exchange(other.node_, nullptr);
+      alloc_ = std::move(other.alloc_);
+      other.alloc_.reset();
+    }
+    return *this;
+  }
+
+  ~NodeHandle() {
+    reset();
+  }
+
+  bool empty() const noexcept {
+    return node_ == nullptr;
+  }
+
+  explicit operator bool() const noexcept {
+    return node_ != nullptr;
+  }
+
+  T& value() const {
+    return *node_->value();
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(*alloc_);
+  }
+
+  void swap(NodeHandle& other) noexcept {
+    std::swap(node_, other.node_);
+    std::swap(alloc_, other.alloc_);
+  }
+
+ private:
+  friend class List;
+  friend class MpscQueue<T, Alloc>;
+
+  NodeHandle(Node* node, const NodeAlloc& alloc)
+      : node_(node),
+        alloc_(alloc) {
+  }
+
+  void reset() noexcept {
+    if (node_ != nullptr) {
+      NodeAllocTraits::destroy(*alloc_, node_->value());
+      NodeAllocTraits::deallocate(*alloc_, node_, 1);
+      node_ = nullptr;
+      alloc_.reset();
+    }
+  }
+
+  Node* node_ = nullptr;
+  std::optional<NodeAlloc> alloc_;
+};
+
+// Lock-free queue from any number of producer threads to one consumer
+// thread, which links List nodes through their own `next` pointers, so that
+// a node moves from a producer's list to the consumer's without being
+// reallocated. A push is one atomic exchange and one store; the consumer
+// takes nodes in the order of those exchanges, without locks and without
+// ever waiting on a producer. A node whose producer has exchanged but not
+// yet stored its link is not visible until it has, and neither are the
+// nodes behind it.
+//
+// emplace() and push() allocate from `Alloc` in the producer threads, which
+// it must allow: std::allocator, or a StackAllocator on a Concurrent
+// storage. Nodes pushed as node handles, and lists drained into, need an
+// allocator comparing equal to the queue's.
+template <typename T, typename Alloc>
+class MpscQueue {
+  using ListType = List<T, Alloc>;
+  using BaseNode = typename ListType::BaseNode;
+  using Node = typename ListType::Node;
+  using NodeAlloc = typename ListType::NodeAlloc;
+
+ public:
+  using value_type = T;
+  using allocator_type = Alloc;
+  using node_type = typename ListType::node_type;
+
+  MpscQueue()
+      : MpscQueue(Alloc()) {
+  }
+
+  explicit MpscQueue(const Alloc& alloc)
+      : alloc_(alloc) {
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Destroys the nodes still queued; no producer may be pushing.
+  ~MpscQueue() {
+    for (BaseNode* node = pop_node(); node != nullptr; node = pop_node()) {
+      ListType::destroy_node_with(alloc_, static_cast<Node*>(node));
+    }
+  }
+
+  allocator_type get_allocator() const {
+    return alloc_;
+  }
+
+  // Producers.
+
+  template <typename... Args>
+  void emplace(Args&&... args) {
+    push_node(ListType::create_node_with(alloc_, std::forward<Args>(args)...));
+  }
+
+  void push(const T& value) {
+    emplace(value);
+  }
+
+  void push(T&& value) {
+    emplace(std::move(value));
+  }
+
+  // Queues the node held by `handle`, if any, and leaves `handle` empty.
+  void push(node_type&& handle) noexcept {
+    if (!handle.empty()) {
+      push_node(ListType::release(handle));
+    }
+  }
+
+  // The consumer.
+
+  // The oldest visible element, as a handle that is empty if there is none.
+  node_type try_pop() noexcept {
+    BaseNode* node = pop_node();
+    if (node == nullptr) {
+      return node_type();
+    }
+    return node_type(static_cast<Node*>(node), alloc_);
+  }
+
+  // Moves every visible element to the end of `list` in queue order,
+  // without allocating, and returns how many there were.
+  size_t drain_into(ListType& list) noexcept {
+    size_t count = 0;
+    for (BaseNode* node = pop_node(); node != nullptr; node = pop_node()) {
+      list.link_before(&list.fake_, node);
+      ++count;
+    }
+    return count;
+  }
+
+ private:
+  // std::atomic_ref is not in every standard library yet, so links are
+  // loaded and stored with the builtins it is made of.
+  static BaseNode* load_next(BaseNode* node) noexcept {
+    return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  }
+
+  static void store_next(BaseNode* node, BaseNode* next) noexcept {
+    __atomic_store_n(&node->next, next, __ATOMIC_RELEASE);
+  }
+
+  void push_node(BaseNode* node) noexcept {
+    __atomic_store_n(&node->next, nullptr, __ATOMIC_RELAXED);
+    BaseNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+    store_next(prev, node);
+  }
+
+  // The queue always holds at least one node: the consumer keeps the last
+  // node it has seen linked until a later one follows it, and when the
+  // queue would run dry the stub node is pushed to take its place.
+  BaseNode* pop_node() noexcept {
+    BaseNode* tail = tail_;
+    BaseNode* next = load_next(tail);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = load_next(next);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    push_node(&stub_);
+    next = load_next(tail);
+    if (next == nullptr) {
+      return nullptr;
+    }
+    tail_ = next;
+    return tail;
+  }
+
+  [[no_unique_address]] NodeAlloc alloc_;
+  BaseNode stub_ = {nullptr, nullptr};
+  // Producers' end, on a cache line of its own.
+  alignas(64) std::atomic<BaseNode*> head_ = &stub_;
+  // The consumer's end.
+  alignas(64) BaseNode* tail_ = &stub_;
+};
+
+// List that keeps up to K elements in each node, in a run of adjacent slots,
+// so that a walk visits one node per K elements and an `int` costs little
+// more than its own size. Pushes and pops at either end never move an
+// element, and neither do insert() and erase() at the edge of a node's run:
+// there iterators and references stay valid as in List. Inserting or erasing
+// inside a run moves the elements of that node from `pos` on, and only
+// iterators and references to those are invalidated.
+template <typename T, typename Alloc = std::allocator<T>, size_t K = 16>
+class UnrolledList {
+  static_assert(K > 0, "a node must hold at least one element");
+
+ private:
+  template <bool IsConst>
+  class BaseIterator;
+
+ public:
+  using value_type = T;
+  using allocator_type = Alloc;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = BaseIterator<false>;
+  using const_iterator = BaseIterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  UnrolledList()
+      : UnrolledList(Alloc()) {
+  }
+
+  explicit UnrolledList(const Alloc& alloc)
+      : alloc_(alloc) {
+  }
+
+  UnrolledList(size_t count, const T& value, const Alloc& alloc = Alloc())
+      : alloc_(alloc) {
+    try {
+      for (size_t i = 0; i < count; ++i) {
+        push_back(value);
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  UnrolledList(const UnrolledList& other)
+      : UnrolledList(other,
+                     AllocTraits::select_on_container_copy_construction(
+                         other.get_allocator())) {
+  }
+
+  UnrolledList(const UnrolledList& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    try {
+      for (const T& value : other) {
+        push_back(value);
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  UnrolledList(UnrolledList&& other) noexcept
+      : alloc_(std::move(other.alloc_)) {
+    take_nodes(other);
+  }
+
+  // Takes the nodes of `other` if `alloc` compares equal to its allocator,
+  // and otherwise moves its elements to new nodes one by one.
+  UnrolledList(UnrolledList&& other, const Alloc& alloc)
+      : alloc_(alloc) {
+    if (alloc_ == other.alloc_) {
+      take_nodes(other);
+      return;
+    }
+    try {
+      for (T& value : other) {
+        emplace_back(std::move(value));
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  ~UnrolledList() {
+    clear();
+  }
+
+  UnrolledList& operator=(const UnrolledList& other) {
+    if (this != &other) {
+      UnrolledList copy(
+          other,
+          AllocTraits::propagate_on_container_copy_assignment::value
+              ? other.get_allocator()
+              : get_allocator());
+      swap_all(copy);
+    }
+    return *this;
+  }
+
+  // An allocator that does not propagate keeps its list, which then moves
+  // the elements over unless the allocators compare equal.
+  UnrolledList& operator=(UnrolledList&& other) noexcept(move_steals_nodes) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (move_steals_nodes) {
+      UnrolledList moved(std::move(other));
+      swap_all(moved);
+    } else {
+      UnrolledList moved(std::move(other), get_allocator());
+      swap_all(moved);
+    }
+    return *this;
+  }
+
+  // Allocators are swapped only if they propagate on swap; if they do not,
+  // they must compare equal.
+  void swap(UnrolledList& other) noexcept {
+    if constexpr (AllocTraits::propagate_on_container_swap::value) {
+      std::swap(alloc_, other.alloc_);
+    }
+    swap_nodes(other);
+  }
+
+  allocator_type get_allocator() const {
+    return alloc_;
+  }
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  T& front() {
+    return *begin();
+  }
+
+  const T& front() const {
+    return *begin();
+  }
+
+  T& back() {
+    return *rbegin();
+  }
+
+  const T& back() const {
+    return *rbegin();
+  }
+
+  iterator begin() noexcept {
+    return iterator(fake_.next, fake_.next->first);
+  }
+
+  const_iterator begin() const noexcept {
+    return cbegin();
+  }
+
+  const_iterator cbegin() const noexcept {
+    return const_iterator(fake_.next, fake_.next->first);
+  }
+
+  iterator end() noexcept {
+    return iterator(&fake_, 0);
+  }
+
+  const_iterator end() const noexcept {
+    return cend();
+  }
+
+  const_iterator cend() const noexcept {
+    return const_iterator(const_cast<BaseNode*>(&fake_), 0);
+  }
+
+  reverse_iterator rbegin() noexcept {
+    return reverse_iterator(end());
+  }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return crbegin();
+  }
+
+  const_reverse_iterator crbegin() const noexcept {
+    return const_reverse_iterator(cend());
+  }
+
+  reverse_iterator rend() noexcept {
+    return reverse_iterator(begin());
+  }
+
+  const_reverse_iterator rend() const noexcept {
+    return crend();
+  }
+
+  const_reverse_iterator crend() const noexcept {
+    return const_reverse_iterator(cbegin());
+  }
+
+  void push_back(const T& value) {
+    emplace_back(value);
+  }
+
+  void push_back(T&& value) {
+    emplace_back(std::move(value));
+  }
+
+  void push_front(const T& value) {
+    emplace_front(value);
+  }
+
+  void push_front(T&& value) {
+    emplace_front(std::move(value));
+  }
+
+  void pop_back() {
+    erase(std::prev(cend()));
+  }
+
+  void pop_front() {
+    erase(cbegin());
+  }
+
+  iterator insert(const_iterator pos, const T& value) {
+    return emplace(pos, value);
+  }
+
+  iterator insert(const_iterator pos, T&& value) {
+    return emplace(pos, std::move(value));
+  }
+
+  iterator erase(const_iterator pos) {
+    auto* node = static_cast<Node*>(pos.node_);
+    size_t index = pos.index_;
+    if (index == node->first) {
+      destroy(node, index);
+      node->first = ++index;
+    } else if (index + 1 == node->last) {
+      destroy(node, --node->last);
+    } else {
+      for (size_t i = index; i + 1 < node->last; ++i) {
+        *node->slot(i) = std::move(*node->slot(i + 1));
+      }
+      destroy(node, --node->last);
+    }
+    --size_;
+    if (index < node->last) {
+      return iterator(node, index);
+    }
+    BaseNode* next = node->next;
+    if (node->first == node->last) {
+      destroy_node(node);
+    }
+    return iterator(next, next->first);
+  }
+
+  void clear() noexcept {
+    BaseNode* node = fake_.next;
+    while (node != &fake_) {
+      BaseNode* next = node->next;
+      for (size_t i = node->first; i < node->last; ++i) {
+        destroy(static_cast<Node*>(node), i);
+      }
+      NodeAllocTraits::deallocate(alloc_, static_cast<Node*>(node), 1);
+      node = next;
+    }
+    fake_.prev = &fake_;
+    fake_.next = &fake_;
+    size_ = 0;
+  }
+
+ private:
+  // `first` and `last` bound the run of slots that hold elements. The
+  // sentinel has an empty run at 0, so end() is {&fake_, 0}.
+  struct BaseNode {
+    BaseNode* prev;
+    BaseNode* next;
+    size_t first;
+    size_t last;
+  };
+
+  struct Node : BaseNode {
+    T* slot(size_t index) {
+      return std::launder(
+          reinterpret_cast<T*>(storage + index * sizeof(T)));
+    }
+
+    alignas(T) unsigned char storage[K * sizeof(T)];
+  };
+
+  using AllocTraits = std::allocator_traits<Alloc>;
+  using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+  using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+  static constexpr bool move_steals_nodes =
+      AllocTraits::propagate_on_container_move_assignment::value ||
+      AllocTraits::is_always_equal::value;
+
+  void take_nodes(UnrolledList& other) noexcept {
+    fake_ = other.fake_;
+    size_ = std::exchange(other.size_, 0);
+    relink_ends();
+    other.relink_ends();
+  }
+
+  void swap_nodes(UnrolledList& other) noexcept {
+    std::swap(fake_, other.fake_);
+    std::swap(size_, other.size_);
+    relink_ends();
+    other.relink_ends();
+  }
+
+  // Swaps allocators too, for the assignments: the list they build already
+  // has the allocator this one is to end up with.
+  void swap_all(UnrolledList& other) noexcept {
+    std::swap(alloc_, other.alloc_);
+    swap_nodes(other);
+  }
+
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    BaseNode* last = fake_.prev;
+    if (last != &fake_ && last->last < K) {
+      construct(static_cast<Node*>(last), last->last,
+                std::forward<Args>(args)...);
+      ++last->last;
+      ++size_;
+      return;
+    }
+    link_new_node(&fake_, 0, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  void emplace_front(Args&&... args) {
+    BaseNode* first = fake_.next;
+    if (first != &fake_ && first->first > 0) {
+      construct(static_cast<Node*>(first), first->first - 1,
+                std::forward<Args>(args)...);
+      --first->first;
+      ++size_;
+      return;
+    }
+    link_new_node(first, K - 1, std::forward<Args>(args)...);
+  }
+
+  // At the start of a run the element goes to the end of the previous run
+  // or the front of this one, whichever has room, and otherwise to a node of
+  // its own, filled from the side further inserts there will grow to.
+  // Inside a run, a full node is first split at `pos`.
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    auto* node = static_cast<Node*>(pos.node_);
+    size_t index = pos.index_;
+    if (index == node->first) {
+      BaseNode* prev = node->prev;
+      if (prev != &fake_ && prev->last < K) {
+        construct(static_cast<Node*>(prev), prev->last,
+                  std::forward<Args>(args)...);
+        ++size_;
+        return iterator(prev, prev->last++);
+      }
+      if (node != &fake_ && node->first > 0) {
+        construct(node, node->first - 1, std::forward<Args>(args)...);
+        ++size_;
+        return iterator(node, --node->first);
+      }
+      size_t slot = prev == &fake_ && node != &fake_ ? K - 1 : 0;
+      return link_new_node(node, slot, std::forward<Args>(args)...);
+    }
+    if (node->last == K) {
+      split(node, index);
+    }
+    if (index < node->last) {
+      T value(std::forward<Args>(args)...);
+      construct(node, node->last, std::move(*node->slot(node->last - 1)));
+      ++node->last;
+      for (size_t i = node->last - 2; i > index; --i) {
+        *node->slot(i) = std::move(*node->slot(i - 1));
+      }
+      *node->slot(index) = std::move(value);
+    } else {
+      construct(node, index, std::forward<Args>(args)...);
+      ++node->last;
+    }
+    ++size_;
+    return iterator(node, index);
+  }
+
+  // Moves the elements of `node` from `index` on to a new node right after
+  // it, keeping their slots. Copies instead if moving could throw, so that
+  // a failure leaves the list as it was.
+  void split(Node* node, size_t index) {
+    Node* next = allocate_node(index);
+    try {
+      for (size_t i = index; i < node->last; ++i) {
+        construct(next, i, std::move_if_noexcept(*node->slot(i)));
+        ++next->last;
+      }
+    } catch (...) {
+      for (size_t i = index; i < next->last; ++i) {
+        destroy(next, i);
+      }
+      NodeAllocTraits::deallocate(alloc_, next, 1);
+      throw;
+    }
+    for (size_t i = index; i < node->last; ++i) {
+      destroy(node, i);
+    }
+    node->last = index;
+    link_before(node->next, next);
+  }
+
+  Node* allocate_node(size_t slot) {
+    Node* node = NodeAllocTraits::allocate(alloc_, 1);
+    ::new (static_cast<void*>(node)) Node;
+    node->first = slot;
+    node->last = slot;
+    return node;
+  }
+
+  // Puts a new node holding only the element in `slot` before `pos`.
+  template <typename... Args>
+  iterator link_new_node(BaseNode* pos, size_t slot, Args&&... args) {
+    Node* node = allocate_node(slot);
+    try {
+      construct(node, slot, std::forward<Args>(args)...);
+    } catch (...) {
+      NodeAllocTraits::deallocate(alloc_, node, 1);
+      throw;
+    }
+    ++node->last;
+    link_before(pos, node);
+    ++size_;
+    return iterator(node, slot);
+  }
+
+  template <typename... Args>
+  void construct(Node* node, size_t index, Args&&... args) {
+    NodeAllocTraits::construct(alloc_, node->slot(index),
+                               std::forward<Args>(args)...);
+  }
+
+  void destroy(Node* node, size_t index) noexcept {
+    NodeAllocTraits::destroy(alloc_, node->slot(index));
+  }
+
+  void destroy_node(Node* node) noexcept {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    NodeAllocTraits::deallocate(alloc_, node, 1);
+  }
+
+  static void link_before(BaseNode* pos, BaseNode* node) noexcept {
+    node->prev = pos->prev;
+    node->next = pos;
+    pos->prev->next = node;
+    pos->prev = node;
+  }
+
+  // Points the end nodes back at this list's sentinel after the sentinel was
+  // copied from another list.
+  void relink_ends() noexcept {
+    if (size_ == 0) {
+      fake_.next = &fake_;
+      fake_.prev = &fake_;
+      return;
+    }
+    fake_.next->prev = &fake_;
+    fake_.prev->next = &fake_;
+  }
+
+  [[no_unique_address]] NodeAlloc alloc_;
+  BaseNode fake_ = {&fake_, &fake_, 0, 0};
+  size_t size_ = 0;
+};
+
+template <typename T, typename Alloc, size_t K>
+template <bool IsConst>
+class UnrolledList<T, Alloc, K>::BaseIterator {
+ public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = std::conditional_t<IsConst, const T*, T*>;
+  using reference = std::conditional_t<IsConst, const T&, T&>;
+
+  BaseIterator() = default;
+
+  operator BaseIterator<true>() const
+    requires(!IsConst)
+  {
+    return BaseIterator<true>(node_, index_);
+  }
+
+  reference operator*() const {
+    return *static_cast<Node*>(node_)->slot(index_);
+  }
+
+  pointer operator->() const {
+    return static_cast<Node*>(node_)->slot(index_);
+  }
+
+  BaseIterator& operator++() {
+    if (++index_ == node_->last) {
+      node_ = node_->next;
+      index_ = node_->first;
+    }
+    return *this;
+  }
+
+  BaseIterator operator++(int) {
+    BaseIterator copy = *this;
+    ++*this;
+    return copy;
+  }
+
+  BaseIterator& operator--() {
+    if (index_ == node_->first) {
+      node_ = node_->prev;
+      index_ = node_->last;
+    }
+    --index_;
+    return *this;
+  }
+
+  BaseIterator operator--(int) {
+    BaseIterator copy = *this;
+    --*this;
+    return copy;
+  }
+
+  friend bool operator==(const BaseIterator& lhs, const BaseIterator& rhs) {
+    return lhs.node_ == rhs.node_ && lhs.index_ == rhs.index_;
+  }
+
+ private:
+  friend class UnrolledList;
+  friend class BaseIterator<!IsConst>;
+
+  BaseIterator(BaseNode* node, size_t index)
+      : node_(node),
+        index_(index) {
+  }
+
+  BaseNode* node_ = nullptr;
+  size_t index_ = 0;
+};
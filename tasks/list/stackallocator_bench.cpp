@@ -0,0 +1,229 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stackallocator.h"
+
+namespace {
+
+// Room for a compacted copy of the random insert list next to it.
+constexpr size_t arena_size = 400'000'000;
+constexpr int node_count = 4'000'000;
+
+struct Timings {
+  int64_t build_us;
+  int64_t traverse_us;
+};
+
+// UnrolledList with its default node size, as a two-parameter template.
+template <typename T, typename Alloc>
+using Unrolled = UnrolledList<T, Alloc>;
+
+template <typename F>
+int64_t time_us(F f) {
+  using std::chrono::steady_clock;
+  auto start = steady_clock::now();
+  f();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             steady_clock::now() - start)
+      .count();
+}
+
+template <typename L>
+int64_t walk_twice(const L& lst, uint64_t& checksum) {
+  return time_us([&] {
+    for (int pass = 0; pass < 2; ++pass) {
+      uint64_t sum = 0;
+      for (int value : lst) {
+        sum = sum * 31 + static_cast<uint64_t>(value);
+      }
+      checksum += sum;
+    }
+  });
+}
+
+// Inserts every value before a pseudo-random earlier node, so that the
+// order of the list has nothing to do with the order of the nodes in
+// memory, then walks the list twice.
+template <typename L>
+Timings random_insert(L& lst, uint64_t& checksum) {
+  std::vector<typename L::iterator> nodes;
+  nodes.reserve(node_count);
+  uint64_t state = 88172645463325252ULL;
+  int64_t build_us = time_us([&] {
+    nodes.push_back(lst.insert(lst.end(), 0));
+    for (int i = 1; i < node_count; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      auto pos = nodes[state % nodes.size()];
+      nodes.push_back(lst.insert(pos, i));
+    }
+  });
+  return {build_us, walk_twice(lst, checksum)};
+}
+
+// The edits of ListPerformanceTest in stackallocator_test.cpp: pushes at
+// both ends, inserts before one element, pops from the back, erases a run
+// from the middle. Then the 1.5M elements left are walked twice.
+template <typename L>
+Timings test_sequence(L& lst, uint64_t& checksum) {
+  int64_t build_us = time_us([&] {
+    for (int i = 0; i < 1'000'000; ++i) {
+      lst.push_back(i);
+    }
+    auto it = lst.begin();
+    for (int i = 0; i < 1'000'000; ++i) {
+      lst.push_front(i);
+    }
+    auto it2 = std::prev(it);
+    for (int i = 0; i < 2'000'000; ++i) {
+      lst.insert(it, i);
+    }
+    for (int i = 0; i < 1'500'000; ++i) {
+      lst.pop_back();
+    }
+    for (int i = 0; i < 1'000'000; ++i) {
+      lst.erase(it2++);
+    }
+    for (int i = 0; i < 1'000'000; ++i) {
+      lst.pop_front();
+    }
+    for (int i = 0; i < 1'000'000; ++i) {
+      lst.push_back(i);
+    }
+  });
+  return {build_us, walk_twice(lst, checksum)};
+}
+
+// Runs `workload`, then reports the time of compact() in place of its
+// edits, and that of two more walks.
+template <typename Workload>
+auto then_compact(Workload workload) {
+  return [workload](auto& lst, uint64_t& checksum) {
+    workload(lst, checksum);
+    int64_t compact_us = time_us([&] { lst.compact(); });
+    return Timings{compact_us, walk_twice(lst, checksum)};
+  };
+}
+
+// Runs `workload` on a Container<int, Alloc> three times, with the allocator
+// `with_alloc` passes to its argument, and reports the best times.
+template <template <typename, typename> class Container, typename Workload,
+          typename WithAlloc>
+void run(const std::string& name, Workload workload, WithAlloc with_alloc,
+         uint64_t& checksum) {
+  Timings best = {0, 0};
+  for (int run = 0; run < 3; ++run) {
+    Timings timings = with_alloc([&](const auto& alloc) {
+      Container<int, std::decay_t<decltype(alloc)>> lst(alloc);
+      return workload(lst, checksum);
+    });
+    if (run == 0 || timings.build_us < best.build_us) {
+      best.build_us = timings.build_us;
+    }
+    if (run == 0 || timings.traverse_us < best.traverse_us) {
+      best.traverse_us = timings.traverse_us;
+    }
+  }
+  std::cerr << name << ": " << best.build_us / 1000 << " ms, 2 walks "
+            << best.traverse_us / 1000 << " ms" << std::endl;
+}
+
+template <typename Body>
+auto with_std_allocator(Body body) {
+  return body(std::allocator<int>());
+}
+
+template <typename Policy, typename Body>
+auto with_storage(Body body) {
+  using Storage = StackStorage<arena_size, Policy>;
+  // Plain `new` leaves an inline arena untouched until it is used.
+  std::unique_ptr<Storage> storage(new Storage);
+  return body(StackAllocator<int, arena_size, Policy>(*storage));
+}
+
+// Builds, walks and destroys a million lists of six ints one
+// after another, the life of most lists in a program.
+template <typename L>
+int64_t small_lists(uint64_t& checksum) {
+  constexpr int list_count = 1'000'000;
+  constexpr int list_size = 6;
+  return time_us([&] {
+    for (int i = 0; i < list_count; ++i) {
+      L lst;
+      for (int j = 0; j < list_size; ++j) {
+        lst.push_back(i + j);
+      }
+      for (int value : lst) {
+        checksum += static_cast<uint64_t>(value);
+      }
+    }
+  });
+}
+
+template <typename L>
+void run_small(const std::string& name, uint64_t& checksum) {
+  int64_t best = 0;
+  for (int run = 0; run < 3; ++run) {
+    int64_t us = small_lists<L>(checksum);
+    if (run == 0 || us < best) {
+      best = us;
+    }
+  }
+  std::cerr << name << ": " << best / 1000 << " ms" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  uint64_t checksum = 0;
+  auto random = [](auto& lst, uint64_t& sum) {
+    return random_insert(lst, sum);
+  };
+  auto sequence = [](auto& lst, uint64_t& sum) {
+    return test_sequence(lst, sum);
+  };
+  auto std_alloc = [](auto body) { return with_std_allocator(body); };
+  auto inline_storage = [](auto body) {
+    return with_storage<SingleThreaded>(body);
+  };
+
+  std::cerr << "List, random insert:" << std::endl;
+  run<List>("  std::allocator", random, std_alloc, checksum);
+  run<List>("  inline StackStorage", random, inline_storage, checksum);
+  run<List>(
+      "  mapped StackStorage", random,
+      [](auto body) { return with_storage<Mapped<>>(body); }, checksum);
+  run<List>(
+      "  huge-page StackStorage", random,
+      [](auto body) { return with_storage<Mapped<true>>(body); }, checksum);
+
+  std::cerr << "ListPerformanceTest sequence:" << std::endl;
+  run<List>("  List, std::allocator", sequence, std_alloc, checksum);
+  run<List>("  List, StackAllocator", sequence, inline_storage, checksum);
+  run<Unrolled>("  UnrolledList, std::allocator", sequence, std_alloc,
+                checksum);
+  run<Unrolled>("  UnrolledList, StackAllocator", sequence, inline_storage,
+                checksum);
+
+  std::cerr << "List, compact() after random insert:" << std::endl;
+  run<List>("  std::allocator", then_compact(random), std_alloc, checksum);
+  run<List>("  inline StackStorage", then_compact(random), inline_storage,
+            checksum);
+  std::cerr << "List, compact() after the ListPerformanceTest sequence:"
+            << std::endl;
+  run<List>("  std::allocator", then_compact(sequence), std_alloc, checksum);
+  run<List>("  inline StackStorage", then_compact(sequence), inline_storage,
+            checksum);
+
+  std::cerr << "1M lists of 6 ints, one at a time:" << std::endl;
+  run_small<List<int>>("  std::allocator", checksum);
+  run_small<InlineContainer<List<int, InlineAllocator<int, 256>>>>(
+      "  InlineAllocator, 256 bytes inline", checksum);
+  std::cout << checksum << std::endl;
+}
@@ -8,12 +8,21 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <bit>
 #include <type_traits>
 #include <sstream>
 #include <cassert>
+#include <thread>
 #include <sys/resource.h>
 
 #include "stackallocator.h"
+#include "../deque/deque.h"
+
+#if __has_include(<memory_resource>)
+#include <unordered_map>
+#include "stack_memory_resource.h"
+#define HAS_MEMORY_RESOURCE
+#endif
 
 #ifndef NO_TEST
 
@@ -414,6 +423,623 @@ void TestWhimsicalAllocator() {
     }
 }
 
+void TestFreeListReuse() {
+    StackStorage<200'000> storage;
+    StackAllocator<int, 200'000> alloc(storage);
+    List<int, StackAllocator<int, 200'000>> lst(alloc);
+
+    for (int i = 0; i < 1'000; ++i) {
+        lst.push_back(i);
+    }
+    size_t used = storage.used();
+
+    // Churn far past the arena size: freed nodes must be handed out again.
+    for (int round = 0; round < 1'000; ++round) {
+        for (int i = 0; i < 500; ++i) {
+            lst.pop_front();
+        }
+        for (int i = 0; i < 500; ++i) {
+            lst.push_back(i);
+        }
+    }
+    assert(lst.size() == 1'000);
+    assert(storage.used() == used);
+}
+
+void TestGrowable() {
+    StackStorage<256, Growable<1'024>> storage;
+    StackAllocator<int, 256, Growable<1'024>> alloc(storage);
+    {
+        List<int, StackAllocator<int, 256, Growable<1'024>>> lst(alloc);
+        for (int i = 0; i < 100'000; ++i) {
+            lst.push_back(i);
+        }
+        assert(lst.size() == 100'000);
+        assert(lst.front() == 0 && lst.back() == 99'999);
+
+        // Nodes are 32 bytes, and only the tails of the blocks go unused.
+        assert(storage.used() >= 100'000 * 32);
+        assert(storage.used() <= 100'000 * 32 + 256);
+    }
+
+    // A block larger than the next heap block gets a block of its own.
+    StackAllocator<long double, 256, Growable<1'024>> ldalloc(alloc);
+    auto* pld = ldalloc.allocate(100'000);
+    assert(reinterpret_cast<uintptr_t>(pld) % alignof(long double) == 0);
+    pld[99'999] = 1;
+    ldalloc.deallocate(pld, 100'000);
+
+    auto* pchar = StackAllocator<char, 256, Growable<1'024>>(alloc).allocate(3);
+    auto* pint = alloc.allocate(1);
+    assert(reinterpret_cast<uintptr_t>(pint) % alignof(int) == 0);
+    assert((void*)pchar != (void*)pint);
+    assert((StackStorage<256, Growable<1'024>>::spare_size() == 0));
+
+    // With a spare size, a thread keeps the largest block no larger than it
+    // for the next storage, and frees the rest.
+    using Kept = StackStorage<256, Growable<1'024, 8'192>>;
+    using KeptAlloc = StackAllocator<char, 256, Growable<1'024, 8'192>>;
+    void* first_block = nullptr;
+    {
+        Kept kept;
+        first_block = KeptAlloc(kept).allocate(4'000);
+    }
+    size_t spare = Kept::spare_size();
+    assert(spare >= 4'000 && spare <= 8'192);
+    {
+        Kept kept;
+        KeptAlloc kept_alloc(kept);
+        assert(kept_alloc.allocate(3'000) == first_block);
+        assert(Kept::spare_size() == 0);
+        kept_alloc.allocate(100'000);
+    }
+    assert(Kept::spare_size() == spare);
+    Kept::release_spare();
+    assert(Kept::spare_size() == 0);
+}
+
+template <typename Policy>
+void TestRewind() {
+    using Alloc = StackAllocator<int, 200'000, Policy>;
+    using IntList = List<int, Alloc>;
+    using CharDeque = std::deque<char, StackAllocator<char, 200'000, Policy>>;
+
+    StackStorage<200'000, Policy> storage;
+    Alloc alloc(storage);
+
+    IntList kept(alloc);
+    for (int i = 0; i < 100; ++i) {
+        kept.push_back(i);
+    }
+    for (int i = 0; i < 50; ++i) {
+        kept.pop_back();
+    }
+    size_t used = storage.used();
+
+    for (int round = 0; round < 3; ++round) {
+        StackScope scope(storage);
+
+        // Scratch containers live in the arena too and are abandoned, not destroyed.
+        auto* lst = new (StackAllocator<IntList, 200'000, Policy>(alloc).allocate(1)) IntList(alloc);
+        auto* d = new (StackAllocator<CharDeque, 200'000, Policy>(alloc).allocate(1)) CharDeque(alloc);
+        for (int i = 0; i < 2'000; ++i) {
+            lst->push_back(i);
+            d->push_back(static_cast<char>(i));
+        }
+        for (int i = 0; i < 1'000; ++i) {
+            lst->pop_front();
+        }
+        assert(lst->size() == 1'000);
+        assert(d->size() == 2'000);
+    }
+    assert(storage.used() == used);
+
+    // Nodes freed before the scope are still there for reuse.
+    for (int i = 0; i < 50; ++i) {
+        kept.push_back(i);
+    }
+    assert(storage.used() == used);
+    assert(kept.size() == 100);
+
+    auto mark = storage.checkpoint();
+    auto* pld = StackAllocator<long double, 200'000, Policy>(alloc).allocate(10'000);
+    pld[9'999] = 1;
+    storage.rewind(mark);
+    assert(storage.used() == used);
+}
+
+void PrintStats(std::ostream& out, const StackStorageStats& stats) {
+    out << " StackStorage stats: " << stats.in_use << " bytes in use, high water "
+        << stats.high_water << ", padding " << stats.padding << ", "
+        << stats.allocations << " allocations, " << stats.deallocations
+        << " deallocations; sizes by power of two:";
+    for (size_t count : stats.histogram) {
+        out << " " << count;
+    }
+    out << std::endl;
+}
+
+void TestStats() {
+    StackStorage<200'000, WithStats<>> storage;
+    StackAllocator<char, 200'000, WithStats<>> charalloc(storage);
+    StackAllocator<int, 200'000, WithStats<>> intalloc(charalloc);
+    StackAllocator<long double, 200'000, WithStats<>> ldalloc(charalloc);
+
+    auto* pchar = charalloc.allocate(3);
+    auto* pint = intalloc.allocate(1);
+    auto* pbig = charalloc.allocate(555);
+    auto* pld = ldalloc.allocate(25);
+
+    const StackStorageStats& stats = storage.stats();
+    size_t requested = 3 + sizeof(int) + 555 + 25 * sizeof(long double);
+    assert(stats.in_use == requested);
+    assert(stats.high_water == requested);
+    assert(stats.allocations == 4);
+    assert(stats.deallocations == 0);
+    assert(stats.histogram[2] == 1);                    // 3 bytes
+    assert(stats.histogram[std::bit_width(sizeof(int))] == 1);
+    assert(stats.histogram[10] == 1);                   // 555 bytes
+    // The char and int blocks are rounded up to a size class, and the
+    // long doubles start at the next multiple of their alignment.
+    assert(stats.padding >= (StackStorage<1>::granule - 3) + (StackStorage<1>::granule - sizeof(int)));
+    assert(stats.in_use + stats.padding == storage.used());
+
+    charalloc.deallocate(pchar, 3);
+    intalloc.deallocate(pint, 1);
+    ldalloc.deallocate(pld, 25);
+    charalloc.deallocate(pbig, 555);
+    assert(stats.in_use == 0);
+    assert(stats.high_water == requested);
+    assert(stats.deallocations == 4);
+
+    std::ostringstream oss;
+    PrintStats(oss, stats);
+}
+
+template <typename Policy>
+void TestMapped() {
+    // Far larger than the stack, and costs nothing until used.
+    StackStorage<STORAGE_SIZE, Policy> storage;
+    StackAllocator<int, STORAGE_SIZE, Policy> alloc(storage);
+
+    BasicListTest<StackAllocator<int, STORAGE_SIZE, Policy>>(alloc);
+
+    // Cross several commit steps.
+    List<int, StackAllocator<int, STORAGE_SIZE, Policy>> lst(alloc);
+    for (int i = 0; i < 1'000'000; ++i) {
+        lst.push_back(i);
+    }
+    assert(lst.back() == 999'999);
+    assert(storage.used() >= 1'000'000 * sizeof(int));
+
+    StackAllocator<char, STORAGE_SIZE, Policy> charalloc(alloc);
+    auto* big = charalloc.allocate(50'000'000);
+    big[49'999'999] = 1;
+    charalloc.deallocate(big, 50'000'000);
+}
+
+template <typename L>
+std::string ToString(const L& lst) {
+    std::string s;
+    for (const auto& x : lst) {
+        s += std::to_string(x);
+    }
+    return s;
+}
+
+void TestRelinking() {
+    StackStorage<200'000, WithStats<>> storage;
+    using Alloc = StackAllocator<int, 200'000, WithStats<>>;
+    Alloc alloc(storage);
+
+    List<int, Alloc> lst(alloc);
+    for (int x : {5, 3, 8, 1, 9, 2, 7}) {
+        lst.push_back(x);
+    }
+    List<int, Alloc> other(alloc);
+    for (int x : {0, 4, 6}) {
+        other.push_back(x);
+    }
+    const int* eight = &*std::next(lst.begin(), 2);
+    size_t allocations = storage.stats().allocations;
+
+    lst.reverse();
+    assert(ToString(lst) == "7291835");
+    lst.sort();
+    assert(ToString(lst) == "1235789");
+    lst.merge(other);
+    assert(ToString(lst) == "0123456789");
+    assert(lst.size() == 10 && other.size() == 0);
+    assert(*eight == 8);
+
+    // splice: a whole list, one element, a range, within one list.
+    other.splice(other.end(), lst, std::next(lst.begin(), 8), lst.end());
+    assert(ToString(lst) == "01234567" && ToString(other) == "89");
+    other.splice(other.begin(), lst, lst.begin());
+    assert(ToString(lst) == "1234567" && ToString(other) == "089");
+    lst.splice(lst.begin(), lst, std::next(lst.begin(), 4), lst.end());
+    assert(ToString(lst) == "5671234" && lst.size() == 7);
+    lst.splice(lst.end(), other);
+    assert(ToString(lst) == "5671234089" && other.empty());
+    assert(*eight == 8);
+
+    lst.sort(std::greater<>());
+    assert(ToString(lst) == "9876543210");
+    assert(lst.size() == 10);
+    assert(storage.stats().allocations == allocations);
+
+    for (int x : {3, 3, 3, 1, 1}) {
+        lst.push_back(x);
+    }
+    assert(lst.unique() == 3);
+    assert(ToString(lst) == "987654321031");
+    // The predicate may refer to an element that gets removed.
+    assert(lst.remove(lst.back()) == 2);
+    assert(ToString(lst) == "9876543203");
+    assert(lst.remove_if([](int x) { return x % 2 == 1; }) == 5);
+    assert(ToString(lst) == "86420");
+    assert(lst.size() == 5);
+
+    // A comparison that throws leaves every element in the list.
+    List<int, Alloc> big(alloc);
+    for (int i = 0; i < 100; ++i) {
+        big.push_back((i * 37) % 100);
+    }
+    int calls = 0;
+    try {
+        big.sort([&calls](int a, int b) {
+            if (++calls == 300) {
+                throw std::string("comparison failed");
+            }
+            return a < b;
+        });
+        assert(false);
+    } catch (const std::string&) {
+    }
+    assert(big.size() == 100);
+    assert(std::distance(big.begin(), big.end()) == 100);
+    assert(std::distance(big.rbegin(), big.rend()) == 100);
+    big.sort();
+    int expected = 0;
+    for (int x : big) {
+        assert(x == expected++);
+    }
+}
+
+void TestNodeHandles() {
+    StackStorage<200'000, WithStats<>> storage;
+    using Alloc = StackAllocator<int, 200'000, WithStats<>>;
+    Alloc alloc(storage);
+
+    // An LRU cache: the most recently used key moves to the front, from
+    // whichever list it is in, without allocating.
+    List<int, Alloc> hot(alloc);
+    List<int, Alloc> cold(alloc);
+    for (int i = 0; i < 5; ++i) {
+        cold.push_back(i);
+    }
+    size_t allocations = storage.stats().allocations;
+    const int* three = &*std::next(cold.begin(), 3);
+
+    auto handle = cold.extract(std::next(cold.begin(), 3));
+    assert(!handle.empty() && handle && handle.value() == 3);
+    assert(&handle.value() == three);
+    assert(handle.get_allocator() == alloc);
+    auto it = hot.insert(hot.begin(), std::move(handle));
+    assert(handle.empty() && !handle);
+    assert(&*it == three);
+    assert(ToString(hot) == "3" && ToString(cold) == "0124");
+    for (int key : {1, 4}) {
+        auto pos = std::find(cold.begin(), cold.end(), key);
+        hot.insert(hot.begin(), cold.extract(pos));
+    }
+    assert(ToString(hot) == "413" && ToString(cold) == "02");
+    assert(hot.size() == 3 && cold.size() == 2);
+    hot.insert(hot.end(), decltype(hot)::node_type());
+    assert(hot.size() == 3);
+    assert(storage.stats().allocations == allocations);
+
+    // A handle that keeps its node frees it.
+    size_t deallocations = storage.stats().deallocations;
+    {
+        auto dropped = hot.extract(hot.begin());
+        decltype(dropped) other;
+        other.swap(dropped);
+        assert(dropped.empty() && other.value() == 4);
+        dropped = std::move(other);
+        assert(other.empty() && dropped.value() == 4);
+    }
+    assert(storage.stats().deallocations == deallocations + 1);
+    assert(ToString(hot) == "13");
+
+    // emplace builds elements in place.
+    List<NotDefaultConstructible> special;
+    special.emplace_back(VerySpecialType(1));
+    special.emplace_front(VerySpecialType(0));
+    auto pos = special.emplace(std::next(special.begin()), VerySpecialType(2));
+    assert(pos->x.x == 2 && special.front().x.x == 0 && special.back().x.x == 1);
+
+    Accountant::reset();
+    {
+        List<Accountant> accountants;
+        accountants.emplace_back();
+        accountants.emplace_front();
+        accountants.emplace(accountants.end());
+        assert(accountants.size() == 3);
+        assert(Accountant::ctor_calls == 3);
+    }
+    assert(Accountant::dtor_calls == 3);
+}
+
+void TestCompact() {
+    StackStorage<200'000, WithStats<>> storage;
+    using Alloc = StackAllocator<int, 200'000, WithStats<>>;
+    Alloc alloc(storage);
+
+    // Churn that leaves the list's order unrelated to its nodes' addresses.
+    List<int, Alloc> lst(alloc);
+    std::vector<int> expected;
+    for (int i = 0; i < 1'000; ++i) {
+        auto pos = std::next(lst.begin(), static_cast<long>((i * 7919) % (lst.size() + 1)));
+        lst.insert(pos, i);
+        expected.insert(expected.begin() + (i * 7919) % (expected.size() + 1), i);
+        if (i % 3 == 0) {
+            lst.erase(std::next(lst.begin(), static_cast<long>(lst.size() / 2)));
+            expected.erase(expected.begin() + expected.size() / 2);
+        }
+    }
+    size_t allocations = storage.stats().allocations;
+    size_t deallocations = storage.stats().deallocations;
+
+    lst.compact();
+    assert(std::equal(lst.begin(), lst.end(), expected.begin(), expected.end()));
+    assert(std::equal(lst.rbegin(), lst.rend(), expected.rbegin(), expected.rend()));
+    assert(lst.size() == expected.size());
+    for (auto it = lst.begin(); std::next(it) != lst.end(); ++it) {
+        assert(&*it < &*std::next(it));
+    }
+    assert(storage.stats().allocations == allocations + lst.size());
+    assert(storage.stats().deallocations == deallocations + lst.size());
+
+    // A copy that throws leaves the list as it was.
+    ThrowingAccountant::need_throw = false;
+    List<ThrowingAccountant> accountants;
+    for (int i = 0; i < 10; ++i) {
+        accountants.push_back(ThrowingAccountant(i));
+    }
+    Accountant::reset();
+    ThrowingAccountant::need_throw = true;
+    try {
+        accountants.compact();
+        assert(false);
+    } catch (const std::string&) {
+    }
+    ThrowingAccountant::need_throw = false;
+    assert(Accountant::ctor_calls == Accountant::dtor_calls);
+    assert(accountants.size() == 10);
+    int value = 0;
+    for (const auto& accountant : accountants) {
+        assert(accountant.value == value++);
+    }
+}
+
+// Whether every element of `c` lives inside the object `c` itself.
+template <typename C>
+bool AllInline(const C& c) {
+    auto begin = reinterpret_cast<const char*>(&c);
+    return std::all_of(c.begin(), c.end(), [&](const auto& x) {
+        auto p = reinterpret_cast<const char*>(&x);
+        return p >= begin && p < begin + sizeof(c);
+    });
+}
+
+template <typename C>
+std::vector<int> Elements(const C& c) {
+    return std::vector<int>(c.begin(), c.end());
+}
+
+template <typename C>
+void InlineContainerTest(size_t inline_count) {
+    C a;
+    for (int i = 0; i < static_cast<int>(inline_count); ++i) {
+        a.push_back(i);
+    }
+    assert(AllInline(a));
+    std::vector<int> expected = Elements(a);
+    for (int i = 0; i < 1'000; ++i) {
+        a.push_back(i);
+    }
+    assert(!AllInline(a));
+    for (int i = 0; i < 1'000; ++i) {
+        a.pop_back();
+    }
+    assert(Elements(a) == expected && AllInline(a));
+
+    // Copies and moves build their elements in their own storage.
+    C b = a;
+    assert(Elements(b) == expected && AllInline(b));
+    assert(a.get_allocator() != b.get_allocator());
+    C c = std::move(b);
+    assert(Elements(c) == expected && AllInline(c));
+
+    C d(3, 7);
+    d = a;
+    assert(Elements(d) == expected && AllInline(d));
+    C e;
+    e.push_back(42);
+    e = std::move(d);
+    assert(Elements(e) == expected && AllInline(e));
+
+    C f(2, 5);
+    f.swap(e);
+    assert(Elements(f) == expected && AllInline(f));
+    assert(Elements(e) == std::vector<int>(2, 5) && AllInline(e));
+    std::swap(e, f);
+    assert(Elements(e) == expected && Elements(f) == std::vector<int>(2, 5));
+
+    // A plain copy cannot use the storage inside `a`, and takes the heap.
+    typename C::container_type plain = a;
+    assert(Elements(plain) == expected);
+    assert(plain.get_allocator() == typename C::allocator_type());
+}
+
+template <typename Container>
+struct InlineOf : InlineContainer<Container> {
+    using container_type = Container;
+    using InlineContainer<Container>::InlineContainer;
+};
+
+void TestInlineAllocator() {
+    using ListAlloc = InlineAllocator<int, 256>;
+    InlineContainerTest<InlineOf<List<int, ListAlloc>>>(8);
+
+    using DequeAlloc = InlineAllocator<int, 1'024>;
+    InlineContainerTest<InlineOf<Deque<int, DequeAlloc, ChunkBytes<256>>>>(64);
+
+    // Node handles and splices work within one container's storage.
+    InlineContainer<List<int, ListAlloc>> lst(4, 1);
+    auto handle = lst.extract(lst.begin());
+    lst.insert(lst.end(), std::move(handle));
+    assert(lst.size() == 4 && AllInline(lst));
+}
+
+// Producers push their own increasing numbers; the consumer checks that
+// each producer's numbers come out in order and none is lost.
+template <typename Alloc>
+void MpscQueueThreadsTest(const Alloc& alloc) {
+    constexpr int producers = 4;
+    constexpr int per_producer = 100'000;
+    MpscQueue<int, Alloc> queue(alloc);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p] {
+            for (int i = 0; i < per_producer; ++i) {
+                if (i % 2 == 0) {
+                    queue.push(p * per_producer + i);
+                } else {
+                    queue.emplace(p * per_producer + i);
+                }
+            }
+        });
+    }
+    std::vector<int> next(producers, 0);
+    int received = 0;
+    List<int, Alloc> batch(alloc);
+    while (received < producers * per_producer) {
+        if (auto handle = queue.try_pop()) {
+            int x = handle.value();
+            assert(x % per_producer == next[x / per_producer]++);
+            ++received;
+        }
+        size_t drained = queue.drain_into(batch);
+        for (int x : batch) {
+            assert(x % per_producer == next[x / per_producer]++);
+        }
+        received += static_cast<int>(drained);
+        batch.clear();
+        if (drained == 0) {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(std::all_of(next.begin(), next.end(), [](int n) { return n == per_producer; }));
+    assert(queue.try_pop().empty());
+}
+
+void TestMpscQueue() {
+    StackStorage<200'000, WithStats<>> storage;
+    using Alloc = StackAllocator<int, 200'000, WithStats<>>;
+    Alloc alloc(storage);
+    {
+        MpscQueue<int, Alloc> queue(alloc);
+        assert(queue.try_pop().empty());
+        for (int i = 0; i < 5; ++i) {
+            queue.push(i);
+        }
+        List<int, Alloc> lst(alloc);
+        lst.push_back(5);
+        lst.push_back(6);
+        size_t allocations = storage.stats().allocations;
+
+        // Nodes travel between lists and the queue without allocating.
+        queue.push(lst.extract(lst.begin()));
+        auto first = queue.try_pop();
+        assert(first && first.value() == 0);
+        lst.insert(lst.end(), std::move(first));
+        assert(ToString(lst) == "60");
+        List<int, Alloc> out(alloc);
+        assert(queue.drain_into(out) == 5);
+        assert(ToString(out) == "12345" && out.size() == 5);
+        assert(queue.try_pop().empty());
+        assert(queue.drain_into(out) == 0);
+        assert(storage.stats().allocations == allocations);
+
+        queue.emplace(7);
+        queue.push(8);
+    }
+    // The queue destroyed what was left in it.
+    assert(storage.stats().in_use == 0);
+
+    MpscQueueThreadsTest(std::allocator<int>());
+    using Storage = StackStorage<32'000'000, Concurrent<>>;
+    std::unique_ptr<Storage> shared(new Storage);
+    MpscQueueThreadsTest(StackAllocator<int, 32'000'000, Concurrent<>>(*shared));
+}
+
+// A thread moving between concurrent storages keeps the slab and free lists
+// of each, so neither loses capacity to the other.
+void TestConcurrentStorages() {
+    constexpr size_t size = 1 << 20;
+    constexpr size_t slab = 4'096;
+    using Storage = StackStorage<size, Concurrent<slab>>;
+    std::unique_ptr<Storage> storages[3];
+    for (auto& storage : storages) {
+        storage.reset(new Storage);
+    }
+
+    std::vector<void*> blocks[3];
+    for (int i = 0; i < 10'000; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            blocks[j].push_back(storages[j]->allocate(16, 16));
+        }
+    }
+    for (int j = 0; j < 3; ++j) {
+        // 10'000 blocks of 16 bytes fill 40 slabs and part of one more.
+        assert(storages[j]->used() <= 41 * slab);
+    }
+
+    // Blocks freed while switching storages go back on each one's lists.
+    for (int round = 0; round < 100; ++round) {
+        for (int j = 0; j < 3; ++j) {
+            storages[j]->deallocate(blocks[j].back(), 16, 16);
+            blocks[j].pop_back();
+        }
+        for (int j = 0; j < 3; ++j) {
+            blocks[j].push_back(storages[j]->allocate(16, 16));
+        }
+    }
+    for (int j = 0; j < 3; ++j) {
+        assert(storages[j]->used() <= 41 * slab);
+        for (void* block : blocks[j]) {
+            storages[j]->deallocate(block, 16, 16);
+        }
+    }
+
+    // A storage can still be filled to the end while others are in use.
+    size_t allocated = 0;
+    try {
+        while (true) {
+            storages[0]->allocate(16, 16);
+            storages[1]->allocate(16, 16);
+            allocated += 16;
+        }
+    } catch (const std::bad_alloc&) {
+    }
+    assert(allocated + slab >= size);
+}
+
 template <class List>
 int ListPerformanceTest(List&& l) {
     using namespace std::chrono;
@@ -468,6 +1094,117 @@ int ListPerformanceTest(List&& l) {
     return duration_cast<milliseconds>(finish - start).count();
 }
 
+// Random edits of an UnrolledList with small nodes, checked against std::list.
+template <typename Alloc>
+void UnrolledListRandomTest(Alloc alloc) {
+    UnrolledList<int, Alloc, 3> lst(alloc);
+    std::list<int> expected;
+    uint64_t state = 12345;
+    auto next = [&state](size_t bound) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<size_t>(state >> 33) % bound;
+    };
+    for (int i = 0; i < 20'000; ++i) {
+        size_t pos = next(expected.size() + 1);
+        switch (next(6)) {
+        case 0:
+            lst.push_back(i);
+            expected.push_back(i);
+            break;
+        case 1:
+            lst.push_front(i);
+            expected.push_front(i);
+            break;
+        case 2: {
+            auto it = lst.insert(std::next(lst.cbegin(), pos), i);
+            assert(*it == i);
+            expected.insert(std::next(expected.begin(), pos), i);
+            break;
+        }
+        case 3:
+            if (pos < expected.size()) {
+                auto it = lst.erase(std::next(lst.cbegin(), pos));
+                auto exp = expected.erase(std::next(expected.begin(), pos));
+                assert((it == lst.end()) == (exp == expected.end()));
+                assert(exp == expected.end() || *it == *exp);
+            }
+            break;
+        case 4:
+            if (!expected.empty()) {
+                lst.pop_back();
+                expected.pop_back();
+            }
+            break;
+        default:
+            if (!expected.empty()) {
+                lst.pop_front();
+                expected.pop_front();
+            }
+            break;
+        }
+        assert(lst.size() == expected.size());
+        if (i % 1'000 == 0) {
+            assert(std::equal(lst.begin(), lst.end(), expected.begin(), expected.end()));
+            assert(std::equal(lst.rbegin(), lst.rend(), expected.rbegin(), expected.rend()));
+        }
+    }
+    assert(std::equal(lst.begin(), lst.end(), expected.begin(), expected.end()));
+
+    // Pushes and pops at the ends move nothing.
+    const int* front = &lst.front();
+    const int* back = &lst.back();
+    for (int i = 0; i < 100; ++i) {
+        lst.push_front(i);
+        lst.push_back(i);
+    }
+    for (int i = 0; i < 100; ++i) {
+        lst.pop_front();
+        lst.pop_back();
+    }
+    assert(&lst.front() == front && &lst.back() == back);
+
+    auto copy = lst;
+    assert(std::equal(copy.begin(), copy.end(), expected.begin(), expected.end()));
+    UnrolledList<int, Alloc, 3> moved(std::move(copy));
+    assert(copy.empty() && moved.size() == expected.size());
+    copy = moved;
+    moved.clear();
+    assert(moved.begin() == moved.end());
+    moved.swap(copy);
+    assert(std::equal(moved.begin(), moved.end(), expected.begin(), expected.end()));
+}
+
+void TestUnrolledList() {
+    UnrolledListRandomTest(std::allocator<int>());
+    ListPerformanceTest(UnrolledList<int>());
+
+    StackStorage<4'096, Growable<>> storage;
+    StackAllocator<int, 4'096, Growable<>> alloc(storage);
+    UnrolledListRandomTest(alloc);
+    ListPerformanceTest(UnrolledList<int, decltype(alloc)>(alloc));
+
+    // Stack allocators do not propagate, so a list moved into one on another
+    // storage keeps its allocator and moves the elements over.
+    using StringAlloc = StackAllocator<std::string, 4'096, Growable<>>;
+    using Unrolled = UnrolledList<std::string, StringAlloc, 3>;
+    StackStorage<4'096, Growable<>> other_storage;
+    Unrolled lst{StringAlloc(storage)};
+    Unrolled other(10, std::string(100, 'a'), StringAlloc(other_storage));
+    lst = std::move(other);
+    other.clear();
+    assert(lst.get_allocator() == StringAlloc(storage) && lst.size() == 10);
+    assert(std::all_of(lst.begin(), lst.end(), [](const std::string& s) {
+        return s == std::string(100, 'a');
+    }));
+
+    // Lists on one storage swap their nodes and keep their allocators.
+    Unrolled same(3, "b", StringAlloc(storage));
+    lst.swap(same);
+    assert(lst.size() == 3 && same.size() == 10 && lst.front() == "b");
+    assert(lst.get_allocator() == same.get_allocator());
+    assert(lst.get_allocator() == StringAlloc(storage));
+}
+
 template <typename Alloc>
 void DequeTest() {
     Alloc alloc(STATIC_STORAGE);
@@ -496,21 +1233,23 @@ void DequeTest() {
 }
 
 
-template <template<typename, typename> class Container>
+template <template<typename, typename> class Container,
+          size_t N = STORAGE_SIZE, typename Policy = DefaultStoragePolicy>
 void TestPerformance() {
 
     std::ostringstream oss_first;
     std::ostringstream oss_second;
+    std::ostringstream oss_stats;
     
     int first = 0;
     int second = 0;
 
     {
-        StackStorage<STORAGE_SIZE> storage;
-        StackAllocator<int, STORAGE_SIZE> alloc(storage);
+        StackStorage<N, Policy> storage;
+        StackAllocator<int, N, Policy> alloc(storage);
         
         first = ListPerformanceTest(Container<int, std::allocator<int>>());
-        second = ListPerformanceTest(Container<int, StackAllocator<int, STORAGE_SIZE>>(alloc));
+        second = ListPerformanceTest(Container<int, StackAllocator<int, N, Policy>>(alloc));
         std::ignore = first;
         std::ignore = second;
         first = 0, second = 0;
@@ -524,12 +1263,17 @@ void TestPerformance() {
         mean_first += first;
         oss_first << first << " ";
 
-        StackStorage<STORAGE_SIZE> storage;
-        StackAllocator<int, STORAGE_SIZE> alloc(storage);
+        StackStorage<N, Policy> storage;
+        StackAllocator<int, N, Policy> alloc(storage);
         second = ListPerformanceTest(
-                Container<int, StackAllocator<int, STORAGE_SIZE>>(alloc));
+                Container<int, StackAllocator<int, N, Policy>>(alloc));
         mean_second += second;
         oss_second << second << " ";
+
+        if constexpr (requires { storage.stats(); }) {
+            oss_stats.str("");
+            PrintStats(oss_stats, storage.stats());
+        }
     }
 
     mean_first /= 5;
@@ -537,6 +1281,7 @@ void TestPerformance() {
 
     std::cerr << " Results with std::allocator: " << oss_first.str() 
             << " ms, results with StackAllocator: " << oss_second.str() << " ms " << std::endl;
+    std::cerr << oss_stats.str();
     
     if (mean_first * 0.9 < mean_second) {
         throw std::runtime_error("StackAllocator expected to be at least 10\% faster than std::allocator, but mean time were "
@@ -546,6 +1291,122 @@ void TestPerformance() {
 
 
 
+#ifdef HAS_MEMORY_RESOURCE
+
+void TestMemoryResource() {
+    StackStorage<200'000> storage;
+    StackMemoryResource<200'000> resource(storage);
+
+    std::pmr::vector<int> v(&resource);
+    for (int i = 0; i < 1'000; ++i) {
+        v.push_back(i);
+    }
+    std::pmr::string str("a string too long for the small string buffer", &resource);
+    std::pmr::unordered_map<int, std::pmr::string> m(&resource);
+    for (int i = 0; i < 100; ++i) {
+        m.emplace(i, str);
+    }
+    assert(v[999] == 999);
+    assert(m.at(42) == str);
+    assert(m.at(42).get_allocator().resource() == &resource);
+
+    // Everything above came from the arena.
+    assert(storage.used() >= 1'000 * sizeof(int) + 100 * str.size());
+
+    StackMemoryResource<200'000> same(storage);
+    StackStorage<200'000> other_storage;
+    StackMemoryResource<200'000> other(other_storage);
+    assert(resource == same);
+    assert(resource != other);
+    assert(resource != *std::pmr::new_delete_resource());
+}
+
+void TestMemoryResourcePerformance() {
+    std::ostringstream oss_first;
+    std::ostringstream oss_second;
+    double mean_first = 0.0;
+    double mean_second = 0.0;
+
+    for (int i = 0; i < 3; ++i) {
+        int first = ListPerformanceTest(std::pmr::list<int>(std::pmr::new_delete_resource()));
+        mean_first += first;
+        oss_first << first << " ";
+
+        StackStorage<STORAGE_SIZE> storage;
+        StackMemoryResource<STORAGE_SIZE> resource(storage);
+        int second = ListPerformanceTest(std::pmr::list<int>(&resource));
+        mean_second += second;
+        oss_second << second << " ";
+    }
+
+    std::cerr << " Results with new_delete_resource: " << oss_first.str()
+            << " ms, results with StackMemoryResource: " << oss_second.str() << " ms " << std::endl;
+
+    if (mean_first * 0.9 < mean_second) {
+        throw std::runtime_error("StackMemoryResource expected to be at least 10\% faster than new_delete_resource, but mean time were "
+                + std::to_string(mean_second / 3) + " ms comparing with " + std::to_string(mean_first / 3) + " :((( ...\n");
+    }
+}
+
+#endif
+
+constexpr size_t CONCURRENT_STORAGE_SIZE = 600'000'000;
+using ConcurrentStorage = StackStorage<CONCURRENT_STORAGE_SIZE, Concurrent<>>;
+
+template <typename T>
+using ConcurrentAllocator = StackAllocator<T, CONCURRENT_STORAGE_SIZE, Concurrent<>>;
+
+// Runs ListPerformanceTest on `threads` threads at once, each with its own
+// list, and returns the wall time.
+template <template<typename, typename> class Container, typename Alloc>
+int ConcurrentListPerformanceTest(int threads, const Alloc& alloc) {
+    using namespace std::chrono;
+
+    auto start = high_resolution_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&alloc] {
+            ListPerformanceTest(Container<int, Alloc>(alloc));
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto finish = high_resolution_clock::now();
+    return duration_cast<milliseconds>(finish - start).count();
+}
+
+template <template<typename, typename> class Container>
+void TestConcurrentPerformance() {
+    int max_threads = std::clamp<int>(std::thread::hardware_concurrency(), 1, 4);
+
+    int single = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        int first = ConcurrentListPerformanceTest<Container>(threads, std::allocator<int>());
+
+        // `new` without parentheses leaves the arena untouched until used.
+        std::unique_ptr<ConcurrentStorage> storage(new ConcurrentStorage);
+        int second = ConcurrentListPerformanceTest<Container>(
+                threads, ConcurrentAllocator<int>(*storage));
+        if (threads == 1) {
+            single = second;
+        }
+
+        // With linear scaling the wall time stays that of one thread.
+        std::cerr << " " << threads << " threads: std::allocator " << first
+                << " ms, shared StackStorage " << second << " ms ("
+                << static_cast<double>(single) * threads / std::max(second, 1)
+                << "x of one thread)" << std::endl;
+
+        if (first * 0.9 < second) {
+            throw std::runtime_error("Shared StackStorage expected to be at least 10\% faster than std::allocator with "
+                    + std::to_string(threads) + " threads, but took " + std::to_string(second)
+                    + " ms comparing with " + std::to_string(first) + " :((( ...\n");
+        }
+    }
+}
+
+
 int main() {
 
     const rlim_t kStackSize = 210 * 1024 * 1024;   // min stack size = 16 MB
@@ -628,6 +1489,62 @@ int main() {
     TestWhimsicalAllocator();
     
     std::cerr << "Test 7 (Allocator Awareness) passed." << std::endl;
+
+    TestFreeListReuse();
+
+    std::cerr << "Test 8 (FreeListReuse) passed." << std::endl;
+
+    TestGrowable();
+
+    std::cerr << "Test 9 (Growable) passed." << std::endl;
+
+    TestRewind<SingleThreaded>();
+    TestRewind<Growable<1'024>>();
+
+    std::cerr << "Test 10 (Rewind) passed." << std::endl;
+
+    TestStats();
+
+    std::cerr << "Test 11 (Stats) passed." << std::endl;
+
+    TestMapped<Mapped<>>();
+    TestMapped<Mapped<true>>();
+
+    std::cerr << "Test 12 (Mapped) passed." << std::endl;
+
+    TestRelinking();
+
+    std::cerr << "Test 13 (Relinking) passed." << std::endl;
+
+#ifdef HAS_MEMORY_RESOURCE
+    TestMemoryResource();
+
+    std::cerr << "Test 14 (MemoryResource) passed." << std::endl;
+#endif
+
+    TestUnrolledList();
+
+    std::cerr << "Test 15 (UnrolledList) passed." << std::endl;
+
+    TestNodeHandles();
+
+    std::cerr << "Test 16 (NodeHandles) passed." << std::endl;
+
+    TestCompact();
+
+    std::cerr << "Test 17 (Compact) passed." << std::endl;
+
+    TestInlineAllocator();
+
+    std::cerr << "Test 18 (InlineAllocator) passed." << std::endl;
+
+    TestMpscQueue();
+
+    std::cerr << "Test 19 (MpscQueue) passed." << std::endl;
+
+    TestConcurrentStorages();
+
+    std::cerr << "Test 20 (ConcurrentStorages) passed." << std::endl;
     
     std::cerr << "Starting performance test. First, let's test performance of different allocators with std::list." << std::endl;
 
@@ -637,6 +1554,20 @@ int main() {
 
     TestPerformance<List>();
 
+    std::cerr << "Once more with a growable StackStorage that starts at 4 KB." << std::endl;
+
+    TestPerformance<List, 4'096, Growable<>>();
+
+#ifdef HAS_MEMORY_RESOURCE
+    std::cerr << "And std::pmr::list on a StackMemoryResource." << std::endl;
+
+    TestMemoryResourcePerformance();
+
+#endif
+    std::cerr << "Now a List per thread, all on one shared StackStorage." << std::endl;
+
+    TestConcurrentPerformance<List>();
+
     std::cerr << "Tests passed, my sweetheart!" << std::endl;
 
     if (std::is_assignable_v<List<int>, std::list<int>> || std::is_assignable_v<std::list<int>, List<int>>) {
@@ -0,0 +1,630 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Policies for the reference counts of SharedPtr. A policy that defines
+// `is_atomic` as true lets pointers to one object be copied and dropped in
+// several threads at once.
+
+// Counts updated with atomic read-modify-writes, as std::shared_ptr does.
+struct AtomicRefCount {
+  static constexpr bool is_atomic = true;
+};
+
+// Plain counts, for objects whose pointers never leave one thread at a time.
+// Copying or dropping a pointer is then an ordinary increment or decrement
+// instead of a locked instruction the compiler cannot merge or elide.
+struct LocalRefCount {
+  static constexpr bool is_atomic = false;
+};
+
+template <typename T, typename RefCount = AtomicRefCount>
+class SharedPtr;
+
+template <typename T, typename RefCount = AtomicRefCount>
+class WeakPtr;
+
+template <typename T, typename RefCount = AtomicRefCount>
+class EnableSharedFromThis;
+
+template <typename T, typename RefCount = AtomicRefCount, typename Alloc,
+          typename... Args>
+SharedPtr<T, RefCount> allocateShared(  // NOLINT(readability-identifier-naming)
+    const Alloc& alloc, Args&&... args);
+
+// The counts shared by every SharedPtr and WeakPtr to one object. The weak
+// count is the number of WeakPtrs plus one while any SharedPtr is left, so
+// whichever pointer goes last frees the block, and does so once.
+//
+// What the object is and how it and the block are freed is up to the
+// derived block, which keeps its deleter and allocator inline and is freed
+// through deallocate_self(), never through a pointer to this class.
+template <typename RefCount>
+class BaseControlBlock {
+  static constexpr bool is_atomic = RefCount::is_atomic;
+  using Count = std::conditional_t<is_atomic, std::atomic<size_t>, size_t>;
+
+ public:
+  BaseControlBlock(const BaseControlBlock&) = delete;
+  BaseControlBlock& operator=(const BaseControlBlock&) = delete;
+
+  size_t use_count() const noexcept {
+    if constexpr (is_atomic) {
+      return shared_.load(std::memory_order_relaxed);
+    } else {
+      return shared_;
+    }
+  }
+
+  void add_shared() noexcept {
+    if constexpr (is_atomic) {
+      shared_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ++shared_;
+    }
+  }
+
+  // Adds an owner unless the object is already gone.
+  bool try_add_shared() noexcept {
+    if constexpr (is_atomic) {
+      size_t count = shared_.load(std::memory_order_relaxed);
+      while (count != 0) {
+        if (shared_.compare_exchange_weak(count, count + 1,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+      return false;
+    } else {
+      if (shared_ == 0) {
+        return false;
+      }
+      ++shared_;
+      return true;
+    }
+  }
+
+  void add_weak() noexcept {
+    if constexpr (is_atomic) {
+      weak_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ++weak_;
+    }
+  }
+
+  void release_shared() noexcept {
+    bool last = false;
+    if constexpr (is_atomic) {
+      last = shared_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    } else {
+      last = --shared_ == 0;
+    }
+    if (last) {
+      destroy_object();
+      release_weak();
+    }
+  }
+
+  // A count of one is the caller's own reference, which nobody else can
+  // copy, so the block is freed without a read-modify-write, the usual
+  // case when the last SharedPtr goes and there are no WeakPtrs.
+  void release_weak() noexcept {
+    bool last = false;
+    if constexpr (is_atomic) {
+      last = weak_.load(std::memory_order_acquire) == 1 ||
+             weak_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    } else {
+      last = --weak_ == 0;
+    }
+    if (last) {
+      deallocate_self();
+    }
+  }
+
+ protected:
+  BaseControlBlock() = default;
+  ~BaseControlBlock() = default;
+
+ private:
+  virtual void destroy_object() noexcept = 0;
+  virtual void deallocate_self() noexcept = 0;
+
+  Count shared_ = 1;
+  Count weak_ = 1;
+};
+
+// Block for an object allocated apart from it, which `Deleter` frees.
+template <typename Y, typename Deleter, typename Alloc, typename RefCount>
+class ControlBlockWithPointer : public BaseControlBlock<RefCount> {
+  using BlockAlloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<ControlBlockWithPointer>;
+  using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+ public:
+  ControlBlockWithPointer(Y* ptr, Deleter deleter, const BlockAlloc& alloc)
+      : ptr_(ptr),
+        deleter_(std::move(deleter)),
+        alloc_(alloc) {
+  }
+
+  static ControlBlockWithPointer* create(Y* ptr, Deleter deleter,
+                                         const Alloc& alloc) {
+    BlockAlloc block_alloc(alloc);
+    ControlBlockWithPointer* block = BlockTraits::allocate(block_alloc, 1);
+    return new (block)
+        ControlBlockWithPointer(ptr, std::move(deleter), block_alloc);
+  }
+
+ private:
+  void destroy_object() noexcept override {
+    deleter_(ptr_);
+  }
+
+  void deallocate_self() noexcept override {
+    BlockAlloc alloc = alloc_;
+    this->~ControlBlockWithPointer();
+    BlockTraits::deallocate(alloc, this, 1);
+  }
+
+  Y* ptr_;
+  [[no_unique_address]] Deleter deleter_;
+  [[no_unique_address]] BlockAlloc alloc_;
+};
+
+// Block with the object inside it, made by allocateShared() in a single
+// allocation. The object is constructed and destroyed through `Alloc`.
+template <typename T, typename Alloc, typename RefCount>
+class ControlBlockWithObject : public BaseControlBlock<RefCount> {
+  using BlockAlloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<ControlBlockWithObject>;
+  using BlockTraits = std::allocator_traits<BlockAlloc>;
+  using ObjectAlloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<std::remove_cv_t<T>>;
+  using ObjectTraits = std::allocator_traits<ObjectAlloc>;
+
+ public:
+  explicit ControlBlockWithObject(const BlockAlloc& alloc)
+      : alloc_(alloc) {
+  }
+
+  // Allocates a block and constructs the object in it from `args`.
+  template <typename... Args>
+  static ControlBlockWithObject* create(const Alloc& alloc, Args&&... args) {
+    BlockAlloc block_alloc(alloc);
+    ControlBlockWithObject* block = BlockTraits::allocate(block_alloc, 1);
+    new (block) ControlBlockWithObject(block_alloc);
+    try {
+      ObjectAlloc object_alloc(block_alloc);
+      ObjectTraits::construct(object_alloc, block->object(),
+                              std::forward<Args>(args)...);
+    } catch (...) {
+      block->~ControlBlockWithObject();
+      BlockTraits::deallocate(block_alloc, block, 1);
+      throw;
+    }
+    return block;
+  }
+
+  std::remove_cv_t<T>* object() noexcept {
+    return std::launder(reinterpret_cast<std::remove_cv_t<T>*>(storage_));
+  }
+
+ private:
+  void destroy_object() noexcept override {
+    ObjectAlloc object_alloc(alloc_);
+    ObjectTraits::destroy(object_alloc, object());
+  }
+
+  void deallocate_self() noexcept override {
+    BlockAlloc alloc = alloc_;
+    this->~ControlBlockWithObject();
+    BlockTraits::deallocate(alloc, this, 1);
+  }
+
+  [[no_unique_address]] BlockAlloc alloc_;
+  alignas(T) unsigned char storage_[sizeof(T)];
+};
+
+// Owns an object together with the other SharedPtrs it was copied from.
+// Each group has one control block: a pointer made from a raw pointer
+// allocates it next to the object, makeShared() and allocateShared() make
+// the object inside it. `RefCount` decides how the counts are kept;
+// pointers with different policies do not convert to one another.
+template <typename T, typename RefCount>
+class SharedPtr {
+  using Block = BaseControlBlock<RefCount>;
+
+ public:
+  using element_type = T;
+
+  SharedPtr() noexcept = default;
+
+  SharedPtr(std::nullptr_t) noexcept {
+  }
+
+  template <typename Y>
+  explicit SharedPtr(Y* ptr)
+    requires(std::is_convertible_v<Y*, T*>)
+      : SharedPtr(ptr, std::default_delete<Y>()) {
+  }
+
+  template <typename Y, typename Deleter>
+  SharedPtr(Y* ptr, Deleter deleter)
+    requires(std::is_convertible_v<Y*, T*>)
+      : SharedPtr(ptr, std::move(deleter), std::allocator<Y>()) {
+  }
+
+  // Takes ownership of `ptr` even if the control block cannot be
+  // allocated: then `deleter` frees it before the exception leaves.
+  template <typename Y, typename Deleter, typename Alloc>
+  SharedPtr(Y* ptr, Deleter deleter, const Alloc& alloc)
+    requires(std::is_convertible_v<Y*, T*>)
+      : ptr_(ptr) {
+    try {
+      block_ = ControlBlockWithPointer<Y, Deleter, Alloc, RefCount>::create(
+          ptr, deleter, alloc);
+    } catch (...) {
+      deleter(ptr);
+      throw;
+    }
+    enable_shared_from_this_with(ptr);
+  }
+
+  // Shares ownership with `other` but points to `ptr`, usually a member of
+  // the object `other` owns.
+  template <typename Y>
+  SharedPtr(const SharedPtr<Y, RefCount>& other, T* ptr) noexcept
+      : ptr_(ptr),
+        block_(other.block_) {
+    if (block_ != nullptr) {
+      block_->add_shared();
+    }
+  }
+
+  SharedPtr(const SharedPtr& other) noexcept
+      : SharedPtr(other, other.ptr_) {
+  }
+
+  template <typename Y>
+  SharedPtr(const SharedPtr<Y, RefCount>& other) noexcept
+    requires(std::is_convertible_v<Y*, T*>)
+      : SharedPtr(other, other.ptr_) {
+  }
+
+  SharedPtr(SharedPtr&& other) noexcept
+      : ptr_(std::exchange(other.ptr_, nullptr)),
+        block_(std::exchange(other.block_, nullptr)) {
+  }
+
+  template <typename Y>
+  SharedPtr(SharedPtr<Y, RefCount>&& other) noexcept
+    requires(std::is_convertible_v<Y*, T*>)
+      : ptr_(std::exchange(other.ptr_, nullptr)),
+        block_(std::exchange(other.block_, nullptr)) {
+  }
+
+  // Throws std::bad_weak_ptr if the object `other` points to is gone.
+  template <typename Y>
+  explicit SharedPtr(const WeakPtr<Y, RefCount>& other)
+    requires(std::is_convertible_v<Y*, T*>)
+  {
+    if (other.block_ == nullptr || !other.block_->try_add_shared()) {
+      throw std::bad_weak_ptr();
+    }
+    ptr_ = other.ptr_;
+    block_ = other.block_;
+  }
+
+  ~SharedPtr() {
+    if (block_ != nullptr) {
+      block_->release_shared();
+    }
+  }
+
+  SharedPtr& operator=(const SharedPtr& other) noexcept {
+    SharedPtr(other).swap(*this);
+    return *this;
+  }
+
+  template <typename Y>
+  SharedPtr& operator=(const SharedPtr<Y, RefCount>& other) noexcept {
+    SharedPtr(other).swap(*this);
+    return *this;
+  }
+
+  SharedPtr& operator=(SharedPtr&& other) noexcept {
+    SharedPtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  template <typename Y>
+  SharedPtr& operator=(SharedPtr<Y, RefCount>&& other) noexcept {
+    SharedPtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  void reset() noexcept {
+    SharedPtr().swap(*this);
+  }
+
+  template <typename Y>
+  void reset(Y* ptr) {
+    SharedPtr(ptr).swap(*this);
+  }
+
+  template <typename Y, typename Deleter>
+  void reset(Y* ptr, Deleter deleter) {
+    SharedPtr(ptr, std::move(deleter)).swap(*this);
+  }
+
+  template <typename Y, typename Deleter, typename Alloc>
+  void reset(Y* ptr, Deleter deleter, const Alloc& alloc) {
+    SharedPtr(ptr, std::move(deleter), alloc).swap(*this);
+  }
+
+  void swap(SharedPtr& other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    std::swap(block_, other.block_);
+  }
+
+  T* get() const noexcept {
+    return ptr_;
+  }
+
+  T& operator*() const noexcept {
+    return *ptr_;
+  }
+
+  T* operator->() const noexcept {
+    return ptr_;
+  }
+
+  size_t use_count() const noexcept {
+    return block_ == nullptr ? 0 : block_->use_count();
+  }
+
+  explicit operator bool() const noexcept {
+    return ptr_ != nullptr;
+  }
+
+  template <typename Y>
+  bool operator==(const SharedPtr<Y, RefCount>& other) const noexcept {
+    return ptr_ == other.get();
+  }
+
+  bool operator==(std::nullptr_t) const noexcept {
+    return ptr_ == nullptr;
+  }
+
+ private:
+  template <typename Y, typename R>
+  friend class SharedPtr;
+
+  template <typename Y, typename R>
+  friend class WeakPtr;
+
+  template <typename Y, typename R, typename Alloc, typename... Args>
+  // NOLINTNEXTLINE(readability-identifier-naming)
+  friend SharedPtr<Y, R> allocateShared(const Alloc& alloc, Args&&... args);
+
+  struct AdoptTag {};
+
+  // Adopts an owner already counted in `block`.
+  SharedPtr(AdoptTag /*tag*/, T* ptr, Block* block) noexcept
+      : ptr_(ptr),
+        block_(block) {
+  }
+
+  // Points the weak pointer of an EnableSharedFromThis base of `*ptr` at
+  // this group, unless another group already owns the object.
+  template <typename U>
+  void enable_shared_from_this_with(
+      const EnableSharedFromThis<U, RefCount>* base) noexcept {
+    if (base != nullptr && base->weak_this_.expired()) {
+      base->weak_this_ = SharedPtr<U, RefCount>(
+          *this, const_cast<U*>(static_cast<const U*>(base)));
+    }
+  }
+
+  void enable_shared_from_this_with(...) noexcept {
+  }
+
+  T* ptr_ = nullptr;
+  Block* block_ = nullptr;
+};
+
+// Refers to the object of a SharedPtr group without owning it.
+template <typename T, typename RefCount>
+class WeakPtr {
+  using Block = BaseControlBlock<RefCount>;
+
+ public:
+  using element_type = T;
+
+  WeakPtr() noexcept = default;
+
+  template <typename Y>
+  WeakPtr(const SharedPtr<Y, RefCount>& other) noexcept
+    requires(std::is_convertible_v<Y*, T*>)
+      : ptr_(other.ptr_),
+        block_(other.block_) {
+    if (block_ != nullptr) {
+      block_->add_weak();
+    }
+  }
+
+  WeakPtr(const WeakPtr& other) noexcept
+      : ptr_(other.ptr_),
+        block_(other.block_) {
+    if (block_ != nullptr) {
+      block_->add_weak();
+    }
+  }
+
+  // Converting does not read `other.ptr_`, which may point into an object
+  // already destroyed, when the object is gone.
+  template <typename Y>
+  WeakPtr(const WeakPtr<Y, RefCount>& other) noexcept
+    requires(std::is_convertible_v<Y*, T*>)
+      : WeakPtr(other.lock()) {
+    if (block_ == nullptr && other.block_ != nullptr) {
+      block_ = other.block_;
+      block_->add_weak();
+    }
+  }
+
+  WeakPtr(WeakPtr&& other) noexcept
+      : ptr_(std::exchange(other.ptr_, nullptr)),
+        block_(std::exchange(other.block_, nullptr)) {
+  }
+
+  template <typename Y>
+  WeakPtr(WeakPtr<Y, RefCount>&& other) noexcept
+    requires(std::is_convertible_v<Y*, T*>)
+      : WeakPtr(other) {
+    other.reset();
+  }
+
+  ~WeakPtr() {
+    if (block_ != nullptr) {
+      block_->release_weak();
+    }
+  }
+
+  WeakPtr& operator=(const WeakPtr& other) noexcept {
+    WeakPtr(other).swap(*this);
+    return *this;
+  }
+
+  template <typename Y>
+  WeakPtr& operator=(const WeakPtr<Y, RefCount>& other) noexcept {
+    WeakPtr(other).swap(*this);
+    return *this;
+  }
+
+  template <typename Y>
+  WeakPtr& operator=(const SharedPtr<Y, RefCount>& other) noexcept {
+    WeakPtr(other).swap(*this);
+    return *this;
+  }
+
+  WeakPtr& operator=(WeakPtr&& other) noexcept {
+    WeakPtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  template <typename Y>
+  WeakPtr& operator=(WeakPtr<Y, RefCount>&& other) noexcept {
+    WeakPtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  void reset() noexcept {
+    WeakPtr().swap(*this);
+  }
+
+  void swap(WeakPtr& other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    std::swap(block_, other.block_);
+  }
+
+  size_t use_count() const noexcept {
+    return block_ == nullptr ? 0 : block_->use_count();
+  }
+
+  bool expired() const noexcept {
+    return use_count() == 0;
+  }
+
+  // An owner of the object, or an empty pointer if it is gone.
+  SharedPtr<T, RefCount> lock() const noexcept {
+    if (block_ == nullptr || !block_->try_add_shared()) {
+      return SharedPtr<T, RefCount>();
+    }
+    return SharedPtr<T, RefCount>(typename SharedPtr<T, RefCount>::AdoptTag(),
+                                  ptr_, block_);
+  }
+
+ private:
+  template <typename Y, typename R>
+  friend class SharedPtr;
+
+  template <typename Y, typename R>
+  friend class WeakPtr;
+
+  T* ptr_ = nullptr;
+  Block* block_ = nullptr;
+};
+
+// Base of a class whose member functions need SharedPtrs to the object
+// they are called on. It keeps a WeakPtr, which the first SharedPtr made
+// from a raw pointer, makeShared() or allocateShared() points at its group.
+template <typename T, typename RefCount>
+class EnableSharedFromThis {
+ public:
+  // Throws std::bad_weak_ptr if no SharedPtr owns the object.
+  SharedPtr<T, RefCount> shared_from_this() {
+    return SharedPtr<T, RefCount>(weak_this_);
+  }
+
+  SharedPtr<const T, RefCount> shared_from_this() const {
+    return SharedPtr<const T, RefCount>(weak_this_);
+  }
+
+  WeakPtr<T, RefCount> weak_from_this() noexcept {
+    return weak_this_;
+  }
+
+  WeakPtr<const T, RefCount> weak_from_this() const noexcept {
+    return weak_this_;
+  }
+
+ protected:
+  EnableSharedFromThis() noexcept = default;
+
+  // A copy is a different object, which no SharedPtr owns yet.
+  EnableSharedFromThis(const EnableSharedFromThis& /*other*/) noexcept {
+  }
+
+  EnableSharedFromThis& operator=(
+      const EnableSharedFromThis& /*other*/) noexcept {
+    return *this;
+  }
+
+  ~EnableSharedFromThis() = default;
+
+ private:
+  template <typename Y, typename R>
+  friend class SharedPtr;
+
+  mutable WeakPtr<T, RefCount> weak_this_;
+};
+
+// Makes a T from `args` inside its control block, in one allocation from
+// `alloc`, which is rebound to the block type. With a StackAllocator the
+// whole block comes from its StackStorage. The counts follow `RefCount`,
+// as in allocateShared<T, LocalRefCount>(alloc, args...).
+template <typename T, typename RefCount, typename Alloc, typename... Args>
+SharedPtr<T, RefCount> allocateShared(  // NOLINT(readability-identifier-naming)
+    const Alloc& alloc, Args&&... args) {
+  auto* block = ControlBlockWithObject<T, Alloc, RefCount>::create(
+      alloc, std::forward<Args>(args)...);
+  SharedPtr<T, RefCount> result(typename SharedPtr<T, RefCount>::AdoptTag(),
+                                block->object(), block);
+  result.enable_shared_from_this_with(block->object());
+  return result;
+}
+
+// Makes a T from `args` inside its control block, in one allocation.
+template <typename T, typename RefCount = AtomicRefCount, typename... Args>
+SharedPtr<T, RefCount> makeShared(  // NOLINT(readability-identifier-naming)
+    Args&&... args) {
+  return allocateShared<T, RefCount>(std::allocator<T>(),
+                                     std::forward<Args>(args)...);
+}
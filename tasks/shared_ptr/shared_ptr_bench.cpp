@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../list/stackallocator.h"
+#include "shared_ptr.h"
+
+namespace {
+
+constexpr int leaf_count = 1 << 20;
+// Room for every block of a tree, whichever pointer it is made of.
+constexpr size_t arena_size = 256'000'000;
+
+struct Timings {
+  int64_t build_us;
+  int64_t walk_us;
+  int64_t destroy_us;
+};
+
+template <typename F>
+int64_t time_us(F f) {
+  using std::chrono::steady_clock;
+  auto start = steady_clock::now();
+  f();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             steady_clock::now() - start)
+      .count();
+}
+
+// A node of a binary tree held together by shared pointers, the shape of
+// most of our object graphs: small objects, each owned through a pointer.
+template <template <typename> class Ptr>
+struct TreeNode {
+  int64_t value;
+  Ptr<TreeNode> left;
+  Ptr<TreeNode> right;
+};
+
+template <template <typename> class Ptr>
+int64_t sum(const Ptr<TreeNode<Ptr>>& node) {
+  if (!node) {
+    return 0;
+  }
+  return node->value + sum<Ptr>(node->left) + sum<Ptr>(node->right);
+}
+
+// Builds a tree of 2 * leaf_count - 1 nodes level by level with `make`,
+// walks it and drops it.
+template <template <typename> class Ptr, typename Make>
+Timings run_tree(Make make, uint64_t& checksum) {
+  using Node = TreeNode<Ptr>;
+  Ptr<Node> root;
+  int64_t build_us = time_us([&] {
+    std::vector<Ptr<Node>> level;
+    level.reserve(leaf_count);
+    for (int i = 0; i < leaf_count; ++i) {
+      level.push_back(make(Node{i, nullptr, nullptr}));
+    }
+    while (level.size() > 1) {
+      std::vector<Ptr<Node>> parents;
+      parents.reserve(level.size() / 2);
+      for (size_t i = 0; i + 1 < level.size(); i += 2) {
+        parents.push_back(make(Node{static_cast<int64_t>(i),
+                                    std::move(level[i]),
+                                    std::move(level[i + 1])}));
+      }
+      level = std::move(parents);
+    }
+    root = std::move(level.front());
+  });
+  int64_t walk_us =
+      time_us([&] { checksum += static_cast<uint64_t>(sum<Ptr>(root)); });
+  int64_t destroy_us = time_us([&] { root = nullptr; });
+  return {build_us, walk_us, destroy_us};
+}
+
+// What passing pointers around costs: assigns pointers to a few thousand
+// objects to a few thousand slots, each assignment one increment and one
+// decrement, copy_count times, and reports the time per copy.
+template <template <typename> class Ptr, typename Make>
+double copy_ns(Make make, uint64_t& checksum) {
+  constexpr int object_count = 4'096;
+  constexpr int64_t copy_count = 50'000'000;
+  std::vector<Ptr<int64_t>> sources;
+  for (int i = 0; i < object_count; ++i) {
+    sources.push_back(make(i));
+  }
+  std::vector<Ptr<int64_t>> slots(object_count);
+  int64_t us = time_us([&] {
+    uint64_t index = 0;
+    for (int64_t i = 0; i < copy_count; ++i) {
+      index = index * 6364136223846793005ULL + 1442695040888963407ULL;
+      slots[i % object_count] = sources[(index >> 32) % object_count];
+    }
+    slots.clear();
+  });
+  for (const auto& source : sources) {
+    checksum += static_cast<uint64_t>(source.use_count());
+  }
+  return static_cast<double>(us) * 1000 / copy_count;
+}
+
+template <template <typename> class Ptr, typename Make>
+void report_copies(const std::string& name, Make make, uint64_t& checksum) {
+  double best = 0;
+  for (int run = 0; run < 3; ++run) {
+    double ns = copy_ns<Ptr>(make, checksum);
+    if (run == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  std::cerr << "  " << name << ": " << best << " ns per copy" << std::endl;
+}
+
+// Runs `body` three times and reports the best times.
+template <typename Body>
+void report(const std::string& name, Body body) {
+  Timings best = {0, 0, 0};
+  for (int run = 0; run < 3; ++run) {
+    Timings timings = body();
+    if (run == 0 || timings.build_us < best.build_us) {
+      best.build_us = timings.build_us;
+    }
+    if (run == 0 || timings.walk_us < best.walk_us) {
+      best.walk_us = timings.walk_us;
+    }
+    if (run == 0 || timings.destroy_us < best.destroy_us) {
+      best.destroy_us = timings.destroy_us;
+    }
+  }
+  std::cerr << "  " << name << ": build " << best.build_us / 1000
+            << " ms, walk " << best.walk_us / 1000 << " ms, destroy "
+            << best.destroy_us / 1000 << " ms" << std::endl;
+}
+
+// The pointers compared, as one-parameter templates.
+template <typename T>
+using StdPtr = std::shared_ptr<T>;
+
+template <typename T>
+using AtomicPtr = SharedPtr<T>;
+
+template <typename T>
+using LocalPtr = SharedPtr<T, LocalRefCount>;
+
+using Storage = StackStorage<arena_size>;
+
+template <typename T>
+using Alloc = StackAllocator<T, arena_size>;
+
+}  // namespace
+
+int main() {
+  uint64_t checksum = 0;
+  std::cerr << 2 * leaf_count - 1 << " tree nodes:" << std::endl;
+
+  report("std::shared_ptr(new T)", [&] {
+    return run_tree<StdPtr>(
+        [](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return std::shared_ptr<Node>(new Node(std::move(node)));
+        },
+        checksum);
+  });
+  report("SharedPtr(new T)", [&] {
+    return run_tree<AtomicPtr>(
+        [](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return SharedPtr<Node>(new Node(std::move(node)));
+        },
+        checksum);
+  });
+  report("std::make_shared", [&] {
+    return run_tree<StdPtr>(
+        [](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return std::make_shared<Node>(std::move(node));
+        },
+        checksum);
+  });
+  report("makeShared", [&] {
+    return run_tree<AtomicPtr>(
+        [](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return makeShared<Node>(std::move(node));
+        },
+        checksum);
+  });
+  report("std::allocate_shared, StackAllocator", [&] {
+    std::unique_ptr<Storage> storage(new Storage);
+    return run_tree<StdPtr>(
+        [&storage](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return std::allocate_shared<Node>(Alloc<Node>(*storage),
+                                            std::move(node));
+        },
+        checksum);
+  });
+  report("allocateShared, StackAllocator", [&] {
+    std::unique_ptr<Storage> storage(new Storage);
+    return run_tree<AtomicPtr>(
+        [&storage](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return allocateShared<Node>(Alloc<Node>(*storage), std::move(node));
+        },
+        checksum);
+  });
+  report("makeShared, LocalRefCount", [&] {
+    return run_tree<LocalPtr>(
+        [](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return makeShared<Node, LocalRefCount>(std::move(node));
+        },
+        checksum);
+  });
+  report("allocateShared, LocalRefCount, StackAllocator", [&] {
+    std::unique_ptr<Storage> storage(new Storage);
+    return run_tree<LocalPtr>(
+        [&storage](auto&& node) {
+          using Node = std::decay_t<decltype(node)>;
+          return allocateShared<Node, LocalRefCount>(Alloc<Node>(*storage),
+                                                     std::move(node));
+        },
+        checksum);
+  });
+
+  // libstdc++ leaves out the atomics of std::shared_ptr until a process
+  // starts a thread, which this one never does; libc++ always has them.
+  std::cerr << "Copying and dropping pointers:" << std::endl;
+  report_copies<StdPtr>(
+      "std::shared_ptr", [](int64_t i) { return std::make_shared<int64_t>(i); },
+      checksum);
+  report_copies<AtomicPtr>(
+      "SharedPtr, AtomicRefCount",
+      [](int64_t i) { return makeShared<int64_t>(i); }, checksum);
+  report_copies<LocalPtr>(
+      "SharedPtr, LocalRefCount",
+      [](int64_t i) { return makeShared<int64_t, LocalRefCount>(i); },
+      checksum);
+  std::cout << checksum << std::endl;
+}
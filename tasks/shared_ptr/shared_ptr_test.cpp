@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "shared_ptr.h"
+#include "../list/stackallocator.h"
+
+#ifndef NO_TEST
+
+// NOLINTBEGIN
+
+// Every call of the global operator new, so that tests can tell how many
+// allocations a pointer costs.
+std::atomic<size_t> new_calls = 0;
+std::atomic<size_t> delete_calls = 0;
+
+void* operator new(size_t n) {
+    ++new_calls;
+    if (void* ptr = std::malloc(n == 0 ? 1 : n)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr != nullptr) {
+        ++delete_calls;
+    }
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    ::operator delete(ptr);
+}
+
+struct Counted {
+    static inline int alive = 0;
+    int value;
+
+    explicit Counted(int value = 0) : value(value) {
+        ++alive;
+    }
+    Counted(const Counted& other) : value(other.value) {
+        ++alive;
+    }
+    virtual ~Counted() {
+        --alive;
+    }
+};
+
+struct DerivedCounted : Counted {
+    static inline int alive_derived = 0;
+    std::string payload;
+
+    DerivedCounted(int value, std::string payload)
+        : Counted(value), payload(std::move(payload)) {
+        ++alive_derived;
+    }
+    ~DerivedCounted() override {
+        --alive_derived;
+    }
+};
+
+template <typename RefCount>
+void TestBasic() {
+    SharedPtr<Counted, RefCount> empty;
+    assert(empty.use_count() == 0);
+    assert(!empty);
+    assert(empty == nullptr);
+
+    {
+        SharedPtr<Counted, RefCount> first(new Counted(5));
+        assert(Counted::alive == 1);
+        assert(first.use_count() == 1);
+        assert(first->value == 5);
+        assert((*first).value == 5);
+
+        SharedPtr<Counted, RefCount> second = first;
+        assert(first.use_count() == 2);
+        assert(second.get() == first.get());
+
+        SharedPtr<Counted, RefCount> third = std::move(second);
+        assert(!second);
+        assert(second.use_count() == 0);
+        assert(third.use_count() == 2);
+
+        second = third;
+        assert(first.use_count() == 3);
+        second = second;
+        assert(first.use_count() == 3);
+
+        third.reset();
+        assert(first.use_count() == 2);
+        second.reset(new Counted(7));
+        assert(Counted::alive == 2);
+        assert(first.use_count() == 1);
+        assert(second.use_count() == 1);
+
+        first.swap(second);
+        assert(first->value == 7);
+        assert(second->value == 5);
+
+        first = std::move(second);
+        assert(Counted::alive == 1);
+        assert(first->value == 5);
+    }
+    assert(Counted::alive == 0);
+
+    {
+        SharedPtr<DerivedCounted, RefCount> derived(
+            new DerivedCounted(1, "payload"));
+        SharedPtr<Counted, RefCount> base = derived;
+        assert(base.use_count() == 2);
+        derived.reset();
+        assert(DerivedCounted::alive_derived == 1);
+
+        // Points into the object but keeps all of it alive.
+        SharedPtr<int, RefCount> member(base, &base->value);
+        base.reset();
+        assert(*member == 1);
+        assert(member.use_count() == 1);
+        assert(DerivedCounted::alive_derived == 1);
+    }
+    assert(DerivedCounted::alive_derived == 0);
+    assert(Counted::alive == 0);
+
+    {
+        // Deleted as the type it was made with, whatever the pointer says.
+        struct NoVirtual {
+            std::string text = "no virtual destructor";
+        };
+        struct Holder : NoVirtual {
+            std::vector<int> data = std::vector<int>(100);
+        };
+        SharedPtr<NoVirtual, RefCount> ptr(new Holder);
+        assert(ptr->text == "no virtual destructor");
+    }
+}
+
+template <typename RefCount>
+void TestWeakPtr() {
+    WeakPtr<Counted, RefCount> weak;
+    assert(weak.expired());
+    assert(!weak.lock());
+
+    {
+        SharedPtr<Counted, RefCount> shared(new Counted(3));
+        weak = shared;
+        assert(!weak.expired());
+        assert(weak.use_count() == 1);
+
+        SharedPtr<Counted, RefCount> locked = weak.lock();
+        assert(locked.use_count() == 2);
+        assert(locked->value == 3);
+
+        WeakPtr<Counted, RefCount> copy = weak;
+        WeakPtr<Counted, RefCount> moved = std::move(copy);
+        assert(moved.use_count() == 2);
+        SharedPtr<Counted, RefCount> from_weak(moved);
+        assert(shared.use_count() == 3);
+    }
+    assert(weak.expired());
+    assert(Counted::alive == 0);
+    assert(!weak.lock());
+
+    bool thrown = false;
+    try {
+        SharedPtr<Counted, RefCount> dead(weak);
+    } catch (const std::bad_weak_ptr&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    {
+        // A weak pointer may outlive the object of makeShared(), which is
+        // destroyed at once even though its memory is not freed yet.
+        auto shared = makeShared<DerivedCounted, RefCount>(4, "four");
+        WeakPtr<Counted, RefCount> base = shared;
+        shared.reset();
+        assert(DerivedCounted::alive_derived == 0);
+        assert(base.expired());
+        WeakPtr<Counted, RefCount> copy = base;
+        assert(copy.expired());
+    }
+}
+
+// makeShared() costs one allocation, a pointer made from `new` costs one
+// more for its block, and neither a deleter nor an allocator costs any.
+void TestAllocations() {
+    size_t before = new_calls;
+    {
+        auto ptr = makeShared<Counted>(1);
+        assert(new_calls == before + 1);
+        auto copy = ptr;
+        WeakPtr<Counted> weak = ptr;
+        assert(new_calls == before + 1);
+    }
+
+    before = new_calls;
+    {
+        auto ptr = makeShared<Counted, LocalRefCount>(1);
+        assert(new_calls == before + 1);
+    }
+
+    before = new_calls;
+    size_t deleted_before = delete_calls;
+    {
+        std::array<char, 64> big_state{};
+        big_state[0] = 'x';
+        bool deleted = false;
+        auto deleter = [big_state, &deleted](Counted* ptr) {
+            assert(big_state[0] == 'x');
+            deleted = true;
+            delete ptr;
+        };
+        Counted* raw = new Counted(2);
+        {
+            SharedPtr<Counted> ptr(raw, deleter);
+            assert(new_calls == before + 2);
+        }
+        assert(deleted);
+    }
+    assert(delete_calls == deleted_before + 2);
+    assert(new_calls == before + 2);
+    assert(Counted::alive == 0);
+}
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    int* allocations;
+    int* constructions;
+
+    CountingAllocator(int* allocations, int* constructions)
+        : allocations(allocations), constructions(constructions) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other)
+        : allocations(other.allocations), constructions(other.constructions) {}
+
+    T* allocate(size_t n) {
+        ++*allocations;
+        return static_cast<T*>(std::malloc(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        --*allocations;
+        std::free(ptr);
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        ++*constructions;
+        new (ptr) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* ptr) {
+        --*constructions;
+        ptr->~U();
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return allocations == other.allocations;
+    }
+};
+
+void TestAllocateShared() {
+    int allocations = 0;
+    int constructions = 0;
+    {
+        CountingAllocator<Counted> alloc(&allocations, &constructions);
+        size_t before = new_calls;
+        auto ptr = allocateShared<Counted>(alloc, 8);
+        assert(new_calls == before);
+        assert(allocations == 1);
+        assert(constructions == 1);
+        assert(ptr->value == 8);
+
+        SharedPtr<Counted> other(new Counted(9), std::default_delete<Counted>(),
+                                 alloc);
+        assert(allocations == 2);
+        // Only the object is made through the allocator, not the block.
+        assert(constructions == 1);
+    }
+    assert(allocations == 0);
+    assert(constructions == 0);
+    assert(Counted::alive == 0);
+
+    {
+        // The whole block comes from the arena.
+        StackStorage<100'000> storage;
+        StackAllocator<Counted, 100'000> alloc(storage);
+        std::vector<SharedPtr<Counted>> ptrs;
+        ptrs.reserve(1'000);
+        size_t before = new_calls;
+        for (int i = 0; i < 1'000; ++i) {
+            ptrs.push_back(allocateShared<Counted>(alloc, i));
+        }
+        assert(new_calls == before);
+        assert(storage.used() >= 1'000 * sizeof(Counted));
+        for (int i = 0; i < 1'000; ++i) {
+            assert(ptrs[i]->value == i);
+        }
+        WeakPtr<Counted> weak = ptrs[500];
+        ptrs.clear();
+        assert(weak.expired());
+        assert(Counted::alive == 0);
+    }
+
+    {
+        // A throwing constructor leaves nothing behind.
+        struct Throwing {
+            Throwing() {
+                throw std::runtime_error("no");
+            }
+        };
+        size_t before = new_calls - delete_calls;
+        bool thrown = false;
+        try {
+            auto ptr = makeShared<Throwing>();
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(new_calls - delete_calls == before);
+        try {
+            auto ptr = allocateShared<Throwing>(
+                CountingAllocator<Throwing>(&allocations, &constructions));
+        } catch (const std::runtime_error&) {
+        }
+        assert(allocations == 0);
+    }
+}
+
+struct Node : EnableSharedFromThis<Node> {
+    int value;
+    explicit Node(int value) : value(value) {}
+
+    SharedPtr<Node> self() {
+        return shared_from_this();
+    }
+};
+
+struct LocalNode : EnableSharedFromThis<LocalNode, LocalRefCount> {
+    SharedPtr<LocalNode, LocalRefCount> self() {
+        return shared_from_this();
+    }
+};
+
+void TestEnableSharedFromThis() {
+    {
+        auto node = makeShared<Node>(1);
+        auto self = node->self();
+        assert(self.get() == node.get());
+        assert(node.use_count() == 2);
+        assert(node->weak_from_this().use_count() == 2);
+        const Node& ref = *node;
+        SharedPtr<const Node> const_self = ref.shared_from_this();
+        assert(node.use_count() == 3);
+    }
+    {
+        SharedPtr<Node> node(new Node(2));
+        assert(node->self().use_count() == 2);
+    }
+    {
+        StackStorage<10'000> storage;
+        StackAllocator<Node, 10'000> alloc(storage);
+        auto node = allocateShared<Node>(alloc, 3);
+        assert(node->self()->value == 3);
+
+        StackAllocator<LocalNode, 10'000> local_alloc(storage);
+        auto local = allocateShared<LocalNode, LocalRefCount>(local_alloc);
+        assert(local->self().get() == local.get());
+        assert(local.use_count() == 1);
+        WeakPtr<LocalNode, LocalRefCount> weak = local->weak_from_this();
+        local.reset();
+        assert(weak.expired());
+    }
+    {
+        Node unowned(4);
+        bool thrown = false;
+        try {
+            unowned.self();
+        } catch (const std::bad_weak_ptr&) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(unowned.weak_from_this().expired());
+    }
+}
+
+// Copies, weak locks and resets of one object from several threads.
+void TestThreads() {
+    auto shared = makeShared<Counted>(42);
+    WeakPtr<Counted> weak = shared;
+    std::vector<std::thread> threads;
+    std::atomic<int> seen = 0;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100'000; ++i) {
+                SharedPtr<Counted> copy = shared;
+                SharedPtr<Counted> locked = weak.lock();
+                if (locked->value == 42 && copy->value == 42) {
+                    seen.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(seen == 400'000);
+    assert(shared.use_count() == 1);
+    shared.reset();
+    assert(weak.expired());
+    assert(Counted::alive == 0);
+}
+
+int main() {
+    static_assert(!std::is_convertible_v<Counted*, SharedPtr<Counted>>);
+    static_assert(std::is_convertible_v<SharedPtr<DerivedCounted>,
+                                        SharedPtr<Counted>>);
+    static_assert(!std::is_constructible_v<SharedPtr<DerivedCounted>,
+                                           SharedPtr<Counted>>);
+    static_assert(!std::is_constructible_v<SharedPtr<Counted, LocalRefCount>,
+                                           SharedPtr<Counted>>);
+    static_assert(!std::is_constructible_v<WeakPtr<Counted>,
+                                           SharedPtr<Counted, LocalRefCount>>);
+    static_assert(sizeof(SharedPtr<int, LocalRefCount>) == 2 * sizeof(void*));
+
+    TestBasic<AtomicRefCount>();
+    TestBasic<LocalRefCount>();
+    std::cerr << "Test 1 (Basic) passed." << std::endl;
+
+    TestWeakPtr<AtomicRefCount>();
+    TestWeakPtr<LocalRefCount>();
+    std::cerr << "Test 2 (WeakPtr) passed." << std::endl;
+
+    TestAllocations();
+    std::cerr << "Test 3 (Allocations) passed." << std::endl;
+
+    TestAllocateShared();
+    std::cerr << "Test 4 (AllocateShared) passed." << std::endl;
+
+    TestEnableSharedFromThis();
+    std::cerr << "Test 5 (EnableSharedFromThis) passed." << std::endl;
+
+    TestThreads();
+    std::cerr << "Test 6 (Threads) passed." << std::endl;
+
+    std::cerr << "Tests passed, my sweetheart!" << std::endl;
+    std::cout << 0;
+}
+
+// NOLINTEND
+
+#else
+
+int main() {
+    std::cerr << "Tests are turned off!\n";
+}
+
+#endif